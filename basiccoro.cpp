@@ -2,13 +2,17 @@
 #include <iostream>
 #include <string>
 #include <print>
+#include <string_view>
 #include <utility>
 
+#include "bench.h"
+#include "framepool.h"
+
 using namespace std::string_literals;
 
 struct Chat {
 
-    struct promise_type {
+    struct promise_type : PooledPromise {
     std::string _msgout{};
     std::string _msgin{};
 
@@ -48,7 +52,7 @@ struct Chat {
     }
 
     void answer(std::string msg) {
-        corohdl.promise()._msgin = msg;
+        corohdl.promise()._msgin = std::move(msg);
         if(!corohdl.done()) corohdl.resume();
     }
 };
@@ -69,8 +73,38 @@ void use()
     std::cout << chat.listen();
 }
 
-int main()
+Chat ping()
+{
+    while (true) {
+        co_yield "ping"s;
+    }
+}
+
+// One listen() is a resume plus the suspend at the next co_yield.
+void suite()
 {
+    static constexpr long OPS = 1000000;
+    BenchSuite bench{"basiccoro"};
+    Chat chat = ping();
+    bench.run("chat_resume", OPS, [&] {
+        for (long i = 0; i < OPS; ++i) {
+            bench_keep(chat.listen());
+        }
+    });
+    bench.run("chat_create_destroy", OPS, [] {
+        for (long i = 0; i < OPS; ++i) {
+            Chat c = ping();
+            bench_keep(c.corohdl);
+        }
+    });
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc > 1 && std::string_view{argv[1]} == "suite") {
+        suite();
+        return 0;
+    }
     use();
     return 0;
 }
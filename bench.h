@@ -0,0 +1,83 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+// Benchmark harness behind the `suite` mode of every program, `make bench`
+// builds them optimized and collects the output. Each case runs one untimed
+// warm-up repetition, then BENCH_REPETITIONS (environment, default 10) timed
+// repetitions of ops operations each. Per-operation statistics go to stderr
+// for people and as one JSON object per line to stdout for regression tracking.
+
+static constexpr int DEFAULT_BENCH_REPETITIONS = 10;
+
+// Keeps the optimizer from discarding a value that is otherwise unused.
+template <typename T>
+inline void bench_keep(const T & value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+class BenchSuite {
+public:
+    explicit BenchSuite(std::string_view program) : m_program{program} {
+        if (const char * env = std::getenv("BENCH_REPETITIONS")) {
+            m_repetitions = std::max(1, std::atoi(env));
+        }
+    }
+
+    // fn() performs ops operations per call. With bytes_per_op set the report
+    // also carries the median throughput in MB/s.
+    template <typename F>
+    void run(std::string_view name, long ops, F && fn, double bytes_per_op = 0) {
+        fn();
+        std::vector<double> samples;
+        for (int i = 0; i < m_repetitions; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            samples.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ops);
+        }
+        report(name, ops, samples, bytes_per_op);
+    }
+
+private:
+    void report(std::string_view name, long ops, std::vector<double> & samples, double bytes_per_op) const {
+        std::sort(samples.begin(), samples.end());
+        const size_t n = samples.size();
+        const double median = (n % 2) ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+        double mean = 0;
+        for (double s : samples) {
+            mean += s;
+        }
+        mean /= n;
+        double variance = 0;
+        for (double s : samples) {
+            variance += (s - mean) * (s - mean);
+        }
+        const double stddev = (n > 1) ? std::sqrt(variance / (n - 1)) : 0;
+        const double mb_per_s = bytes_per_op ? bytes_per_op / median * 1e9 / (1 << 20) : 0;
+
+        std::cerr << m_program << " " << name << ": median " << median << " ns/op, min " << samples.front()
+                  << ", max " << samples.back() << ", stddev " << stddev;
+        if (bytes_per_op) {
+            std::cerr << ", " << mb_per_s << " MB/s";
+        }
+        std::cerr << "\n";
+
+        std::cout << "{\"program\":\"" << m_program << "\",\"case\":\"" << name << "\",\"ops\":" << ops
+                  << ",\"repetitions\":" << n << ",\"unit\":\"ns/op\",\"min\":" << samples.front()
+                  << ",\"median\":" << median << ",\"mean\":" << mean << ",\"stddev\":" << stddev
+                  << ",\"max\":" << samples.back();
+        if (bytes_per_op) {
+            std::cout << ",\"mb_per_s\":" << mb_per_s;
+        }
+        std::cout << "}\n";
+    }
+
+    std::string_view m_program;
+    int m_repetitions = DEFAULT_BENCH_REPETITIONS;
+};
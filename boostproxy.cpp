@@ -1,10 +1,211 @@
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 #include <boost/asio.hpp>
 
+#include "bench.h"
+
 namespace ProxyBoostAsio {
 
+enum class relay_mode { copy, splice };
+
+// Bytes moved per splice() call and the pipe capacity requested for each direction.
+static constexpr size_t SPLICE_CHUNK = 1 << 16;
+static constexpr int SPLICE_PIPE_SIZE = 1 << 20;
+
+// Copy relay buffers start at MIN_RELAY_BUFFER and double while reads fill them, up to MAX_RELAY_BUFFER.
+// They halve after SHRINK_AFTER_READS consecutive reads that use less than a quarter of the buffer.
+static constexpr size_t MIN_RELAY_BUFFER = 4 << 10;
+static constexpr size_t MAX_RELAY_BUFFER = 256 << 10;
+static constexpr int SHRINK_AFTER_READS = 4;
+
+// Per-thread cache of power-of-two blocks from 64 bytes to MAX_RELAY_BUFFER.
+// Shards are single-threaded, so a block is always returned to the cache it
+// came from. Each class keeps a bounded number of free blocks so memory from a
+// burst of bulk transfers goes back to the system.
+class block_cache {
+public:
+    static block_cache & local() {
+        static thread_local block_cache cache;
+        return cache;
+    }
+
+    void * allocate(size_t size) {
+        size_t c = size_class(size);
+        if (free[c].empty()) {
+            return ::operator new(class_size(c));
+        }
+        void * block = free[c].back();
+        free[c].pop_back();
+        return block;
+    }
+
+    void deallocate(void * block, size_t size) {
+        size_t c = size_class(size);
+        if (free[c].size() >= max_cached(c)) {
+            ::operator delete(block);
+            return;
+        }
+        free[c].push_back(block);
+    }
+
+    ~block_cache() {
+        for (auto & blocks : free) {
+            for (void * block : blocks) ::operator delete(block);
+        }
+    }
+
+private:
+    static constexpr size_t MIN_BLOCK = 64;
+    static constexpr size_t NUM_CLASSES = std::bit_width(MAX_RELAY_BUFFER / MIN_BLOCK);
+
+    static size_t size_class(size_t size) { return (size <= MIN_BLOCK) ? 0 : std::bit_width((size - 1) / MIN_BLOCK); }
+    static size_t class_size(size_t c) { return MIN_BLOCK << c; }
+    static size_t max_cached(size_t c) { return (class_size(c) <= 4096) ? 1024 : 16; }
+
+    std::array<std::vector<void*>, NUM_CLASSES> free;
+};
+
+template <typename T>
+struct recycling_allocator {
+    using value_type = T;
+    recycling_allocator() = default;
+    template <typename U> recycling_allocator(const recycling_allocator<U> &) {}
+    T * allocate(size_t n) { return static_cast<T*>(block_cache::local().allocate(n * sizeof(T))); }
+    void deallocate(T * p, size_t n) { block_cache::local().deallocate(p, n * sizeof(T)); }
+    template <typename U> bool operator==(const recycling_allocator<U> &) const { return true; }
+};
+
+struct relay_counts {
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    uint64_t waits = 0;
+    uint64_t bytes = 0;
+
+    uint64_t syscalls() const { return reads + writes + waits; }
+};
+
+// Syscall accounting for the copy relay, reads + writes + readiness waits per
+// byte moved. Like block_cache every thread has its own counters and only that
+// thread writes them, so the relay loop of a shard touches no shared cache
+// line. total() adds up all threads, the exited ones included.
+class relay_stats {
+public:
+    static relay_stats & local() {
+        static thread_local relay_stats stats;
+        return stats;
+    }
+
+    static relay_counts total() {
+        std::lock_guard lock{registry_mutex()};
+        relay_counts sum = retired();
+        for (const relay_stats * s : registry()) s->add_to(sum);
+        return sum;
+    }
+
+    void count_wait() { bump(waits, 1); }
+    void count_read() { bump(reads, 1); }
+    void count_write(size_t n) {
+        bump(writes, 1);
+        bump(bytes, n);
+    }
+
+    relay_stats(const relay_stats &) = delete;
+    relay_stats & operator=(const relay_stats &) = delete;
+
+private:
+    relay_stats() {
+        std::lock_guard lock{registry_mutex()};
+        registry().push_back(this);
+    }
+    ~relay_stats() {
+        std::lock_guard lock{registry_mutex()};
+        add_to(retired());
+        std::erase(registry(), this);
+    }
+
+    // Single writer, readers in total() only need untorn values.
+    static void bump(std::atomic<uint64_t> & counter, uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    void add_to(relay_counts & sum) const {
+        sum.reads += reads.load(std::memory_order_relaxed);
+        sum.writes += writes.load(std::memory_order_relaxed);
+        sum.waits += waits.load(std::memory_order_relaxed);
+        sum.bytes += bytes.load(std::memory_order_relaxed);
+    }
+
+    static std::mutex & registry_mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+    static std::vector<relay_stats*> & registry() {
+        static std::vector<relay_stats*> stats;
+        return stats;
+    }
+    static relay_counts & retired() {
+        static relay_counts counts;
+        return counts;
+    }
+
+    std::atomic<uint64_t> reads{0};
+    std::atomic<uint64_t> writes{0};
+    std::atomic<uint64_t> waits{0};
+    std::atomic<uint64_t> bytes{0};
+};
+
+// Adaptive read buffer for one relay direction. It only holds a block while
+// data keeps arriving, an idle direction owns no buffer at all.
+struct relay_buffer {
+    char * data = nullptr;
+    size_t size = MIN_RELAY_BUFFER;
+    int small_reads = 0;
+
+    bool held() const { return data != nullptr; }
+    void acquire() {
+        if (!data) data = static_cast<char*>(block_cache::local().allocate(size));
+    }
+    void release() {
+        if (data) block_cache::local().deallocate(std::exchange(data, nullptr), size);
+    }
+    void resize(size_t new_size) {
+        bool was_held = held();
+        release();
+        size = new_size;
+        if (was_held) acquire();
+    }
+    void adapt(size_t n) {
+        if (n == size && size < MAX_RELAY_BUFFER) {
+            small_reads = 0;
+            resize(size * 2);
+        } else if (n < size / 4 && size > MIN_RELAY_BUFFER) {
+            if (++small_reads >= SHRINK_AFTER_READS) {
+                small_reads = 0;
+                resize(size / 2);
+            }
+        } else {
+            small_reads = 0;
+        }
+    }
+    ~relay_buffer() { release(); }
+};
+
 struct proxy_state {
     proxy_state(boost::asio::ip::tcp::socket client) : client(std::move(client)) {}
     boost::asio::ip::tcp::socket client;
@@ -14,56 +215,581 @@ struct proxy_state {
 
 using proxy_state_ptr = std::shared_ptr<proxy_state>;
 
-boost::asio::awaitable<void> server_to_client(proxy_state_ptr state){
-    std::array<char, 1024> data;
+// While the last read filled the buffer the loop reads straight into it.
+// Otherwise it returns the buffer to the cache and parks on async_wait, so
+// idle and interactive connections hold no buffer between messages.
+boost::asio::awaitable<void> copy_relay(proxy_state_ptr state, boost::asio::ip::tcp::socket & from, boost::asio::ip::tcp::socket & to) {
+    relay_stats & stats = relay_stats::local();
+    relay_buffer buf;
     for(;;) {
-        auto [e1, n1] = co_await state->server.async_read_some(boost::asio::buffer(data), boost::asio::as_tuple(boost::asio::use_awaitable));
+        if (!buf.held()) {
+            auto [e] = co_await from.async_wait(boost::asio::ip::tcp::socket::wait_read, boost::asio::as_tuple(boost::asio::use_awaitable));
+            stats.count_wait();
+            if (e) break;
+            buf.acquire();
+        }
+        auto [e1, n1] = co_await from.async_read_some(boost::asio::buffer(buf.data, buf.size), boost::asio::as_tuple(boost::asio::use_awaitable));
+        stats.count_read();
         if (e1) break;
-        auto [e2, n2] = co_await async_write(state->client, boost::asio::buffer(data, n1), boost::asio::as_tuple(boost::asio::use_awaitable));
+        auto [e2, n2] = co_await async_write(to, boost::asio::buffer(buf.data, n1), boost::asio::as_tuple(boost::asio::use_awaitable));
+        stats.count_write(n1);
         if (e2) break;
+        bool filled = (n1 == buf.size);
+        buf.adapt(n1);
+        if (!filled) buf.release();
     }
     state->client.close();
     state->server.close();
 }
 
+boost::asio::awaitable<void> server_to_client(proxy_state_ptr state){
+    co_await copy_relay(state, state->server, state->client);
+}
+
 boost::asio::awaitable<void> client_to_server(proxy_state_ptr state){
-    std::array<char, 1024> data;
-    for(;;) {
-        auto [e1, n1] = co_await state->client.async_read_some(boost::asio::buffer(data), boost::asio::as_tuple(boost::asio::use_awaitable));
-        if (e1) break;
-        auto [e2, n2] = co_await async_write(state->server, boost::asio::buffer(data, n1), boost::asio::as_tuple(boost::asio::use_awaitable));
-        if (e2) break;
+    co_await copy_relay(state, state->client, state->server);
+}
+
+// Zero-copy relay: socket -> pipe -> socket with splice(2), so payload never
+// enters user space. Readiness comes from asio's async_wait. Falls back to the
+// copy loop when the pipe cannot be created or the sockets do not support splice.
+boost::asio::awaitable<void> splice_relay(proxy_state_ptr state, boost::asio::ip::tcp::socket & from, boost::asio::ip::tcp::socket & to,
+                                          boost::asio::awaitable<void> (*fallback)(proxy_state_ptr)) {
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+        co_await fallback(state);
+        co_return;
     }
+    fcntl(pipe_fds[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+    from.native_non_blocking(true);
+    to.native_non_blocking(true);
+
+    bool moved = false;
+    bool failed = false;
+    while (!failed) {
+        ssize_t n = splice(from.native_handle(), nullptr, pipe_fds[1], nullptr, SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) {
+                auto [e] = co_await from.async_wait(boost::asio::ip::tcp::socket::wait_read, boost::asio::as_tuple(boost::asio::use_awaitable));
+                if (e) break;
+                continue;
+            }
+            if (errno == EINVAL && !moved) {
+                close(pipe_fds[0]);
+                close(pipe_fds[1]);
+                co_await fallback(state);
+                co_return;
+            }
+            break;
+        }
+        moved = true;
+
+        // The pipe is always drained before the next read, so EAGAIN above means the socket is empty.
+        for (size_t pending = n; pending > 0;) {
+            ssize_t m = splice(pipe_fds[0], nullptr, to.native_handle(), nullptr, pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (m < 0 && errno == EINTR) continue;
+            if (m < 0 && errno == EAGAIN) {
+                auto [e] = co_await to.async_wait(boost::asio::ip::tcp::socket::wait_write, boost::asio::as_tuple(boost::asio::use_awaitable));
+                if (e) {
+                    failed = true;
+                    break;
+                }
+                continue;
+            }
+            if (m <= 0) {
+                failed = true;
+                break;
+            }
+            pending -= m;
+        }
+    }
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
     state->client.close();
     state->server.close();
 }
 
-boost::asio::awaitable<void> proxy(boost::asio::ip::tcp::socket client, boost::asio::ip::tcp::endpoint target) {
-    auto state = std::make_shared<proxy_state>(std::move(client));
-    auto [e] = co_await state->server.async_connect(target, boost::asio::as_tuple(boost::asio::use_awaitable));
+struct upstream_config {
+    std::string host;
+    std::string service;
+    // Warm sockets kept ready. The target grows towards max_idle when acquires
+    // find the pool empty and decays back to min_idle while it stays full.
+    size_t min_idle = 4;
+    size_t max_idle = 64;
+    std::chrono::seconds dns_ttl{30};
+    std::chrono::milliseconds health_interval{1000};
+};
+
+// Per-shard pool of pre-connected upstream sockets with a TTL resolution
+// cache. A socket handed out by acquire() belongs to the proxied connection
+// and is never returned. Pooled sockets are probed before use and on every
+// health tick, the upstream closing or sending data evicts them. The pool is
+// single-threaded like its shard and must outlive the io_context run.
+class upstream_pool {
+public:
+    upstream_pool(boost::asio::any_io_executor ex, upstream_config config)
+        : ex(ex), config(std::move(config)), resolver(ex), timer(ex), resolve_done(ex, boost::asio::steady_timer::time_point::max()),
+          target(this->config.min_idle) {}
+
+    // Fills the pool right away, maintain() first runs after a health_interval.
+    void start() {
+        co_spawn(ex, fill(), boost::asio::detached);
+        co_spawn(ex, maintain(), boost::asio::detached);
+    }
+
+    size_t idle_count() const { return idle.size(); }
+
+    boost::asio::awaitable<boost::system::error_code> acquire(boost::asio::ip::tcp::socket & socket) {
+        while (!idle.empty()) {
+            boost::asio::ip::tcp::socket pooled = std::move(idle.front());
+            idle.pop_front();
+            if (alive(pooled)) {
+                socket = std::move(pooled);
+                co_spawn(ex, fill(), boost::asio::detached);
+                co_return boost::system::error_code{};
+            }
+        }
+        target = std::min(target + 1, config.max_idle);
+        co_spawn(ex, fill(), boost::asio::detached);
+        co_return co_await connect(socket);
+    }
+
+private:
+    // A healthy idle upstream has nothing to read: EOF or unsolicited data both mean evict.
+    static bool alive(boost::asio::ip::tcp::socket & socket) {
+        char c;
+        ssize_t n = ::recv(socket.native_handle(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+
+    // One resolve at a time. Callers arriving while it runs use the stale
+    // entry, or without one wait on resolve_done for its outcome.
+    boost::asio::awaitable<boost::system::error_code> resolve() {
+        if (resolved && std::chrono::steady_clock::now() - resolved_at < config.dns_ttl) {
+            co_return boost::system::error_code{};
+        }
+        if (resolving) {
+            if (!resolved) {
+                co_await resolve_done.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+            }
+            co_return resolved ? boost::system::error_code{} : resolve_error;
+        }
+        resolving = true;
+        auto [e, results] = co_await resolver.async_resolve(config.host, config.service, boost::asio::as_tuple(boost::asio::use_awaitable));
+        resolving = false;
+        // Keep serving the stale entry when a refresh fails.
+        resolve_error = e;
+        if (!e) {
+            endpoints = std::move(results);
+            resolved_at = std::chrono::steady_clock::now();
+            resolved = true;
+        }
+        resolve_done.cancel();
+        co_return resolved ? boost::system::error_code{} : e;
+    }
+
+    boost::asio::awaitable<boost::system::error_code> connect(boost::asio::ip::tcp::socket & socket) {
+        if (auto e = co_await resolve()) {
+            co_return e;
+        }
+        auto [e, endpoint] = co_await boost::asio::async_connect(socket, endpoints, boost::asio::as_tuple(boost::asio::use_awaitable));
+        co_return e;
+    }
+
+    boost::asio::awaitable<void> fill() {
+        while (idle.size() + connecting < target) {
+            ++connecting;
+            boost::asio::ip::tcp::socket socket{ex};
+            auto e = co_await connect(socket);
+            --connecting;
+            if (e) break;
+            idle.push_back(std::move(socket));
+        }
+    }
+
+    boost::asio::awaitable<void> maintain() {
+        for (;;) {
+            timer.expires_after(config.health_interval);
+            auto [e] = co_await timer.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+            if (e) break;
+            std::erase_if(idle, [](boost::asio::ip::tcp::socket & socket) { return !alive(socket); });
+            if (idle.size() >= target && target > config.min_idle) {
+                --target;
+                idle.pop_back();
+            }
+            co_await resolve();
+            co_await fill();
+        }
+    }
+
+    boost::asio::any_io_executor ex;
+    upstream_config config;
+    boost::asio::ip::tcp::resolver resolver;
+    boost::asio::steady_timer timer;
+    // Never expires, cancel() wakes the callers waiting for a resolve in flight.
+    boost::asio::steady_timer resolve_done;
+    boost::asio::ip::tcp::resolver::results_type endpoints;
+    std::chrono::steady_clock::time_point resolved_at{};
+    bool resolved = false;
+    bool resolving = false;
+    boost::system::error_code resolve_error;
+    std::deque<boost::asio::ip::tcp::socket> idle;
+    size_t connecting = 0;
+    size_t target;
+};
+
+boost::asio::awaitable<void> proxy(boost::asio::ip::tcp::socket client, upstream_pool & upstream, relay_mode mode) {
+    auto state = std::allocate_shared<proxy_state>(recycling_allocator<proxy_state>{}, std::move(client));
+    auto e = co_await upstream.acquire(state->server);
     if (!e) {
         auto ex = state->client.get_executor();
-        co_spawn(ex, client_to_server(state), boost::asio::detached);
-        co_await server_to_client(state);
+        if (mode == relay_mode::splice) {
+            co_spawn(ex, splice_relay(state, state->client, state->server, client_to_server), boost::asio::detached);
+            co_await splice_relay(state, state->server, state->client, server_to_client);
+        } else {
+            co_spawn(ex, client_to_server(state), boost::asio::detached);
+            co_await server_to_client(state);
+        }
     }
 }
 
-boost::asio::awaitable<void> listen(boost::asio::ip::tcp::acceptor & acceptor, boost::asio::ip::tcp::endpoint target) {
+boost::asio::awaitable<void> listen(boost::asio::ip::tcp::acceptor & acceptor, upstream_pool & upstream, relay_mode mode) {
     for(;;) {
         auto [e, client] = co_await acceptor.async_accept(boost::asio::as_tuple(boost::asio::use_awaitable));
         if (e) break;
         auto ex = client.get_executor();
-        co_spawn(ex, proxy(std::move(client), target), boost::asio::detached);
+        co_spawn(ex, proxy(std::move(client), upstream, mode), boost::asio::detached);
+    }
+}
+
+using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+// One single-threaded io_context per core with its own SO_REUSEPORT acceptor.
+// The kernel spreads incoming connections over the acceptors and a connection
+// stays on the shard that accepted it, so proxy_state never crosses threads.
+struct shard {
+    explicit shard(upstream_config config) : upstream{ctx.get_executor(), std::move(config)} {}
+    boost::asio::io_context ctx{1};
+    boost::asio::ip::tcp::acceptor acceptor{ctx};
+    upstream_pool upstream;
+    std::thread thread;
+};
+
+using shard_ptr = std::unique_ptr<shard>;
+
+void pin_to_core(unsigned core) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+}
+
+// With port 0 the first shard picks an ephemeral port and the others join it.
+std::vector<shard_ptr> start_shards(boost::asio::ip::tcp::endpoint endpoint, const upstream_config & upstream, relay_mode mode, unsigned count) {
+    std::vector<shard_ptr> shards;
+    for (unsigned i = 0; i < count; ++i) {
+        auto s = std::make_unique<shard>(upstream);
+        s->acceptor.open(endpoint.protocol());
+        s->acceptor.set_option(boost::asio::socket_base::reuse_address(true));
+        s->acceptor.set_option(reuse_port(true));
+        s->acceptor.bind(endpoint);
+        s->acceptor.listen();
+        endpoint = s->acceptor.local_endpoint();
+        s->upstream.start();
+        co_spawn(s->ctx, listen(s->acceptor, s->upstream, mode), boost::asio::detached);
+        shards.push_back(std::move(s));
+    }
+    for (unsigned i = 0; i < count; ++i) {
+        shard & s = *shards[i];
+        s.thread = std::thread([&s, i] {
+            pin_to_core(i);
+            s.ctx.run();
+        });
+    }
+    return shards;
+}
+
+void stop_shards(std::vector<shard_ptr> & shards) {
+    for (auto & s : shards) {
+        s->ctx.stop();
+    }
+    for (auto & s : shards) {
+        s->thread.join();
     }
 }
-} // namespace ProxyBoostAsio
-int main () {
-    boost::asio::io_context ctx1;
-    boost::asio::io_context ctx2;
 
-    boost::asio::ip::tcp::acceptor acceptor(ctx1, {boost::asio::ip::tcp::v4(), 54545});
-    co_spawn(ctx1, ProxyBoostAsio::listen(acceptor, *boost::asio::ip::tcp::resolver(ctx2).resolve("www.boost.org", "80")), boost::asio::detached);
-    ctx2.run();
-    ctx1.run();
+// Local stand-in upstream, holds no buffer while idle so it does not skew the RSS numbers.
+boost::asio::awaitable<void> echo_session(boost::asio::ip::tcp::socket socket) {
+    relay_buffer buf;
+    for(;;) {
+        if (!buf.held()) {
+            auto [e] = co_await socket.async_wait(boost::asio::ip::tcp::socket::wait_read, boost::asio::as_tuple(boost::asio::use_awaitable));
+            if (e) break;
+            buf.acquire();
+        }
+        auto [e1, n1] = co_await socket.async_read_some(boost::asio::buffer(buf.data, buf.size), boost::asio::as_tuple(boost::asio::use_awaitable));
+        if (e1) break;
+        auto [e2, n2] = co_await async_write(socket, boost::asio::buffer(buf.data, n1), boost::asio::as_tuple(boost::asio::use_awaitable));
+        if (e2) break;
+        bool filled = (n1 == buf.size);
+        buf.adapt(n1);
+        if (!filled) buf.release();
+    }
+}
+
+boost::asio::awaitable<void> echo_listen(boost::asio::ip::tcp::acceptor & acceptor) {
+    for(;;) {
+        auto [e, socket] = co_await acceptor.async_accept(boost::asio::as_tuple(boost::asio::use_awaitable));
+        if (e) break;
+        auto ex = socket.get_executor();
+        co_spawn(ex, echo_session(std::move(socket)), boost::asio::detached);
+    }
 }
 
+boost::asio::awaitable<void> bench_writer(boost::asio::ip::tcp::socket & socket, size_t total) {
+    std::vector<char> data(SPLICE_CHUNK, 'x');
+    for (size_t sent = 0; sent < total;) {
+        size_t n = std::min(data.size(), total - sent);
+        auto [e, written] = co_await async_write(socket, boost::asio::buffer(data, n), boost::asio::as_tuple(boost::asio::use_awaitable));
+        if (e) break;
+        sent += written;
+    }
+}
+
+// Pushes total bytes through the proxy to the echo upstream and reads them back.
+boost::asio::awaitable<void> bench_client(boost::asio::ip::tcp::endpoint proxy_endpoint, size_t total, double & seconds) {
+    boost::asio::ip::tcp::socket socket{co_await boost::asio::this_coro::executor};
+    auto [e] = co_await socket.async_connect(proxy_endpoint, boost::asio::as_tuple(boost::asio::use_awaitable));
+    if (e) co_return;
+    auto start = std::chrono::steady_clock::now();
+    co_spawn(socket.get_executor(), bench_writer(socket, total), boost::asio::detached);
+    std::vector<char> data(SPLICE_CHUNK);
+    for (size_t received = 0; received < total;) {
+        auto [e1, n1] = co_await socket.async_read_some(boost::asio::buffer(data), boost::asio::as_tuple(boost::asio::use_awaitable));
+        if (e1) co_return;
+        received += n1;
+    }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+upstream_config local_upstream(boost::asio::ip::tcp::acceptor & echo_acceptor, size_t min_idle = 4) {
+    auto endpoint = echo_acceptor.local_endpoint();
+    return {.host = endpoint.address().to_string(), .service = std::to_string(endpoint.port()), .min_idle = min_idle};
+}
+
+// Mean time from connect to the first echoed byte over sequential short connections.
+boost::asio::awaitable<void> bench_first_byte_client(boost::asio::ip::tcp::endpoint proxy_endpoint, int count, double & mean_us) {
+    std::array<char, 16> data{};
+    double total_us = 0;
+    int completed = 0;
+    for (int i = 0; i < count; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        boost::asio::ip::tcp::socket socket{co_await boost::asio::this_coro::executor};
+        auto [e] = co_await socket.async_connect(proxy_endpoint, boost::asio::as_tuple(boost::asio::use_awaitable));
+        if (e) continue;
+        auto [e1, n1] = co_await async_write(socket, boost::asio::buffer(data), boost::asio::as_tuple(boost::asio::use_awaitable));
+        auto [e2, n2] = co_await async_read(socket, boost::asio::buffer(data, 1), boost::asio::as_tuple(boost::asio::use_awaitable));
+        if (e1 || e2) continue;
+        total_us += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        ++completed;
+    }
+    mean_us = completed ? total_us / completed : 0;
+}
+
+void bench_first_byte(size_t min_idle, int count) {
+    boost::asio::io_context ctx{1};
+    boost::asio::ip::tcp::acceptor echo_acceptor(ctx, {boost::asio::ip::address_v4::loopback(), 0});
+    boost::asio::ip::tcp::acceptor proxy_acceptor(ctx, {boost::asio::ip::address_v4::loopback(), 0});
+    co_spawn(ctx, echo_listen(echo_acceptor), boost::asio::detached);
+    auto config = local_upstream(echo_acceptor, min_idle);
+    config.max_idle = min_idle;
+    upstream_pool upstream{ctx.get_executor(), config};
+    upstream.start();
+    co_spawn(ctx, listen(proxy_acceptor, upstream, relay_mode::splice), boost::asio::detached);
+
+    double mean_us = 0;
+    co_spawn(ctx, bench_first_byte_client(proxy_acceptor.local_endpoint(), count, mean_us), [&](std::exception_ptr) { ctx.stop(); });
+    ctx.run();
+    std::cout << "upstream pool min_idle " << min_idle << ", " << mean_us << " us to first byte\n";
+}
+
+void bench_relay(relay_mode mode, size_t total) {
+    uint64_t syscalls_before = relay_stats::total().syscalls();
+    boost::asio::io_context ctx;
+    boost::asio::ip::tcp::acceptor echo_acceptor(ctx, {boost::asio::ip::address_v4::loopback(), 0});
+    boost::asio::ip::tcp::acceptor proxy_acceptor(ctx, {boost::asio::ip::address_v4::loopback(), 0});
+    co_spawn(ctx, echo_listen(echo_acceptor), boost::asio::detached);
+    upstream_pool upstream{ctx.get_executor(), local_upstream(echo_acceptor)};
+    upstream.start();
+    co_spawn(ctx, listen(proxy_acceptor, upstream, mode), boost::asio::detached);
+
+    double seconds = 0;
+    co_spawn(ctx, bench_client(proxy_acceptor.local_endpoint(), total, seconds), [&](std::exception_ptr) { ctx.stop(); });
+    ctx.run();
+    std::cout << ((mode == relay_mode::splice) ? "splice " : "copy   ")
+              << total / (1 << 20) << " MB echoed through the proxy, "
+              << ((seconds > 0) ? total / seconds / (1 << 20) : 0) << " MB/s";
+    if (mode == relay_mode::copy) {
+        // Each byte crosses the proxy twice, to the echo upstream and back.
+        std::cout << ", " << (relay_stats::total().syscalls() - syscalls_before) / (2.0 * total / (1 << 20)) << " syscalls/MB";
+    }
+    std::cout << "\n";
+}
+
+// Loopback echo throughput through the proxy per relay mode, one client connection per repetition.
+void suite() {
+    static constexpr size_t TOTAL = 1 << 26;
+    BenchSuite bench{"boostproxy"};
+    for (relay_mode mode : {relay_mode::copy, relay_mode::splice}) {
+        boost::asio::io_context ctx{1};
+        boost::asio::ip::tcp::acceptor echo_acceptor(ctx, {boost::asio::ip::address_v4::loopback(), 0});
+        boost::asio::ip::tcp::acceptor proxy_acceptor(ctx, {boost::asio::ip::address_v4::loopback(), 0});
+        co_spawn(ctx, echo_listen(echo_acceptor), boost::asio::detached);
+        upstream_pool upstream{ctx.get_executor(), local_upstream(echo_acceptor)};
+        upstream.start();
+        co_spawn(ctx, listen(proxy_acceptor, upstream, mode), boost::asio::detached);
+        bench.run((mode == relay_mode::splice) ? "relay_splice_64k" : "relay_copy_64k", TOTAL / SPLICE_CHUNK, [&] {
+            double seconds = 0;
+            ctx.restart();
+            co_spawn(ctx, bench_client(proxy_acceptor.local_endpoint(), TOTAL, seconds), [&](std::exception_ptr) { ctx.stop(); });
+            ctx.run();
+        }, SPLICE_CHUNK);
+    }
+}
+
+size_t rss_bytes() {
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+boost::asio::awaitable<void> bench_idle_clients(boost::asio::ip::tcp::endpoint proxy_endpoint, int count, std::vector<boost::asio::ip::tcp::socket> & sockets) {
+    std::array<char, 16> data{};
+    for (int i = 0; i < count; ++i) {
+        boost::asio::ip::tcp::socket socket{co_await boost::asio::this_coro::executor};
+        auto [e] = co_await socket.async_connect(proxy_endpoint, boost::asio::as_tuple(boost::asio::use_awaitable));
+        if (e) break;
+        // One round trip so the upstream leg is connected before the connection goes idle.
+        auto [e1, n1] = co_await async_write(socket, boost::asio::buffer(data), boost::asio::as_tuple(boost::asio::use_awaitable));
+        auto [e2, n2] = co_await async_read(socket, boost::asio::buffer(data), boost::asio::as_tuple(boost::asio::use_awaitable));
+        if (e1 || e2) break;
+        sockets.push_back(std::move(socket));
+    }
+}
+
+// RSS growth per idle proxied connection. Client, proxy and echo legs live in
+// this process, four sockets per connection, so the count is capped by RLIMIT_NOFILE.
+void bench_idle(relay_mode mode, int count) {
+    rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        count = std::min<int>(count, (rl.rlim_cur - 64) / 4);
+    }
+
+    boost::asio::io_context ctx{1};
+    boost::asio::ip::tcp::acceptor echo_acceptor(ctx, {boost::asio::ip::address_v4::loopback(), 0});
+    boost::asio::ip::tcp::acceptor proxy_acceptor(ctx, {boost::asio::ip::address_v4::loopback(), 0});
+    echo_acceptor.listen(boost::asio::socket_base::max_listen_connections);
+    proxy_acceptor.listen(boost::asio::socket_base::max_listen_connections);
+    co_spawn(ctx, echo_listen(echo_acceptor), boost::asio::detached);
+    upstream_pool upstream{ctx.get_executor(), local_upstream(echo_acceptor)};
+    upstream.start();
+    co_spawn(ctx, listen(proxy_acceptor, upstream, mode), boost::asio::detached);
+
+    std::vector<boost::asio::ip::tcp::socket> sockets;
+    sockets.reserve(count);
+    size_t rss_before = rss_bytes();
+    co_spawn(ctx, bench_idle_clients(proxy_acceptor.local_endpoint(), count, sockets), [&](std::exception_ptr) { ctx.stop(); });
+    ctx.run();
+    size_t rss_after = rss_bytes();
+    std::cout << ((mode == relay_mode::splice) ? "splice " : "copy   ") << sockets.size() << " idle connections, "
+              << (rss_after - rss_before) / std::max<size_t>(1, sockets.size()) << " bytes RSS per connection\n";
+}
+// Short-lived connections: connect, echo a small message once, close.
+boost::asio::awaitable<void> bench_connections(boost::asio::ip::tcp::endpoint proxy_endpoint, int count, int & completed) {
+    std::array<char, 64> data{};
+    for (int i = 0; i < count; ++i) {
+        boost::asio::ip::tcp::socket socket{co_await boost::asio::this_coro::executor};
+        auto [e] = co_await socket.async_connect(proxy_endpoint, boost::asio::as_tuple(boost::asio::use_awaitable));
+        if (e) continue;
+        auto [e1, n1] = co_await async_write(socket, boost::asio::buffer(data), boost::asio::as_tuple(boost::asio::use_awaitable));
+        if (e1) continue;
+        auto [e2, n2] = co_await async_read(socket, boost::asio::buffer(data), boost::asio::as_tuple(boost::asio::use_awaitable));
+        if (e2) continue;
+        ++completed;
+    }
+}
+
+// Runs one client thread per shard and reports connections/s and aggregate echo throughput.
+void bench_shards(unsigned max_shards, relay_mode mode, int connections, size_t total) {
+    boost::asio::io_context echo_ctx;
+    boost::asio::ip::tcp::acceptor echo_acceptor(echo_ctx, {boost::asio::ip::address_v4::loopback(), 0});
+    co_spawn(echo_ctx, echo_listen(echo_acceptor), boost::asio::detached);
+    auto echo_guard = boost::asio::make_work_guard(echo_ctx);
+    std::thread echo_thread([&] { echo_ctx.run(); });
+
+    std::vector<unsigned> counts;
+    for (unsigned n = 1; n < max_shards; n *= 2) counts.push_back(n);
+    counts.push_back(max_shards);
+    for (unsigned n : counts) {
+        auto shards = start_shards({boost::asio::ip::address_v4::loopback(), 0}, local_upstream(echo_acceptor), mode, n);
+        auto proxy_endpoint = shards.front()->acceptor.local_endpoint();
+
+        auto run_clients = [&](auto make_client) {
+            std::vector<std::thread> clients;
+            auto start = std::chrono::steady_clock::now();
+            for (unsigned i = 0; i < n; ++i) {
+                clients.emplace_back([&, i] {
+                    boost::asio::io_context ctx{1};
+                    co_spawn(ctx, make_client(i), boost::asio::detached);
+                    ctx.run();
+                });
+            }
+            for (auto & t : clients) t.join();
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        };
+
+        std::vector<int> completed(n, 0);
+        double conn_seconds = run_clients([&](unsigned i) { return bench_connections(proxy_endpoint, connections, completed[i]); });
+        int total_completed = 0;
+        for (int c : completed) total_completed += c;
+
+        std::vector<double> seconds(n, 0);
+        double bulk_seconds = run_clients([&](unsigned i) { return bench_client(proxy_endpoint, total, seconds[i]); });
+        std::cout << "shards " << n << " " << total_completed / conn_seconds << " connections/s, "
+                  << n * total / bulk_seconds / (1 << 20) << " MB/s aggregate\n";
+        stop_shards(shards);
+    }
+    echo_guard.reset();
+    echo_ctx.stop();
+    echo_thread.join();
+}
+} // namespace ProxyBoostAsio
+int main (int argc, char ** argv) {
+    std::string_view mode = (argc > 1) ? argv[1] : "";
+    if (mode == "suite") {
+        ProxyBoostAsio::suite();
+        return 0;
+    }
+    if (mode == "bench") {
+        ProxyBoostAsio::bench_relay(ProxyBoostAsio::relay_mode::copy, 1 << 28);
+        ProxyBoostAsio::bench_relay(ProxyBoostAsio::relay_mode::splice, 1 << 28);
+        ProxyBoostAsio::bench_idle(ProxyBoostAsio::relay_mode::copy, 100000);
+        ProxyBoostAsio::bench_first_byte(0, 2000);
+        ProxyBoostAsio::bench_first_byte(8, 2000);
+        ProxyBoostAsio::bench_shards(std::max(1u, std::thread::hardware_concurrency()), ProxyBoostAsio::relay_mode::splice, 2000, 1 << 26);
+        return 0;
+    }
+    auto relay = (mode == "copy") ? ProxyBoostAsio::relay_mode::copy : ProxyBoostAsio::relay_mode::splice;
+    unsigned num_shards = (argc > 2) ? std::stoul(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+
+    ProxyBoostAsio::upstream_config upstream{.host = "www.boost.org", .service = "80"};
+    auto shards = ProxyBoostAsio::start_shards({boost::asio::ip::tcp::v4(), 54545}, upstream, relay, num_shards);
+    for (auto & s : shards) {
+        s->thread.join();
+    }
+}
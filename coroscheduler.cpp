@@ -1,43 +1,224 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <csignal>
 #include <coroutine>
-#include <list>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <print>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include <sys/time.h>
+
+#include "bench.h"
+#include "framepool.h"
+#include "taskstats.h"
+
+// Build with -DCORO_TRACE to log every resume and suspend.
+#ifdef CORO_TRACE
+#define TRACE(...) std::println(__VA_ARGS__)
+#else
+#define TRACE(...) do {} while (0)
+#endif
+
+// Growable power-of-two ring of coroutine handles, allocates only when it has to grow.
+class ReadyQueue {
+private:
+    std::unique_ptr<std::coroutine_handle<>[]> buf{};
+    size_t capacity = 0;
+    size_t head = 0;
+    size_t count = 0;
+
+    // Out of line so that push_back inlines into every await_suspend.
+    [[gnu::noinline]] void grow() {
+        size_t new_capacity = capacity ? capacity * 2 : 64;
+        auto new_buf = std::make_unique<std::coroutine_handle<>[]>(new_capacity);
+        for (size_t i = 0; i < count; ++i) {
+            new_buf[i] = buf[(head + i) & (capacity - 1)];
+        }
+        buf = std::move(new_buf);
+        capacity = new_capacity;
+        head = 0;
+    }
+
+public:
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    // Forced, with the task table hooks next to it GCC stops inlining it on its own.
+    [[gnu::always_inline]] void push_back(std::coroutine_handle<> h) {
+        if (count == capacity) grow();
+        buf[(head + count++) & (capacity - 1)] = h;
+    }
+
+    std::coroutine_handle<> pop_front() {
+        auto h = buf[head];
+        head = (head + 1) & (capacity - 1);
+        --count;
+        return h;
+    }
+};
+
+// Ready queue levels of Scheduler, HIGH runs first.
+enum class Priority : uint8_t { HIGH, NORMAL, LOW, IDLE };
+static constexpr size_t PRIORITY_LEVELS = 4;
+// Every AGING_PERIOD-th pick serves the next level below the one that would run, in turn.
+static constexpr uint32_t AGING_PERIOD = 64;
+
+// Single-threaded scheduler with one FIFO ready queue per Priority and an
+// earliest-deadline-first heap for yield_until(). Deadline tasks run before
+// every priority level, the levels in order. Bit 0 of a bitmap stands for the
+// heap and bit 1 + level for each queue that has work, so a pick is one count
+// of trailing zeros and O(1) unless it pops the heap. To keep bulk work from
+// starving, every AGING_PERIOD-th pick goes to the next level in round-robin
+// order that has work below the class that would run, with the heap above
+// HIGH, which bounds the wait on any level, HIGH under a stream of deadline
+// tasks included.
 class Scheduler {
 private:
-    std::list<std::coroutine_handle<>> tasks{};
+    struct Deadline {
+        std::chrono::steady_clock::time_point at;
+        std::coroutine_handle<> handle;
+        // Heap order that keeps the earliest deadline at the front.
+        static bool later(const Deadline & a, const Deadline & b) { return a.at > b.at; }
+    };
+
+    static constexpr uint32_t DEADLINES_BIT = 1;
+
+    std::array<ReadyQueue, PRIORITY_LEVELS> levels{};
+    uint32_t nonempty = 0;
+    std::vector<Deadline> deadlines{};
+    uint32_t picks = 0;
+    size_t aging_level = 0;
+    uint64_t missed = 0;
+    FrameArena arena{};
+    TaskTable table{};
+
+    static constexpr uint32_t level_bit(size_t level) { return 2u << level; }
+
+    std::coroutine_handle<> pop_level(size_t level) {
+        auto h = levels[level].pop_front();
+        if (levels[level].empty()) nonempty &= ~level_bit(level);
+        return h;
+    }
+
+    // Kept out of line so the common pick stays small enough to inline.
+    // below holds the bits of the levels under the class a plain pick would serve.
+    [[gnu::noinline]] std::coroutine_handle<> pop_aged(uint32_t below) {
+        do {
+            aging_level = (aging_level + 1) % PRIORITY_LEVELS;
+        } while (!(below & level_bit(aging_level)));
+        return pop_level(aging_level);
+    }
+
+    [[gnu::noinline]] std::coroutine_handle<> pop_deadline() {
+        std::pop_heap(deadlines.begin(), deadlines.end(), Deadline::later);
+        Deadline d = deadlines.back();
+        deadlines.pop_back();
+        if (deadlines.empty()) nonempty &= ~DEADLINES_BIT;
+        if (std::chrono::steady_clock::now() > d.at) ++missed;
+        return d.handle;
+    }
+
+    std::coroutine_handle<> next() {
+        // Clearing the lowest set bit leaves what is queued below the top class.
+        const uint32_t below = nonempty & (nonempty - 1);
+        if (++picks % AGING_PERIOD == 0 && below) [[unlikely]] {
+            return pop_aged(below);
+        }
+        const size_t queue = std::countr_zero(nonempty);
+        if (queue == 0) [[unlikely]] {
+            return pop_deadline();
+        }
+        return pop_level(queue - 1);
+    }
 
 public:
-    auto tasks_count() const { return tasks.size(); }
+    size_t tasks_count() const {
+        size_t count = deadlines.size();
+        for (const ReadyQueue & level : levels) count += level.size();
+        return count;
+    }
+    // Deadline tasks resumed after their deadline had passed.
+    uint64_t deadlines_missed() const { return missed; }
+    // Introspection of the Task coroutines parked here, see taskstats.h.
+    TaskTable & task_table() { return table; }
+    const TaskTable & task_table() const { return table; }
+    // Task frames created while the returned scope lives come from this scheduler's arena.
+    FrameArena::Scope arena_scope() { return FrameArena::Scope{arena}; }
     bool schedule() {
-        auto t = tasks.front();
-        tasks.pop_front();
+        if (!nonempty) {
+            return false;
+        }
+        auto t = next();
 
-        std::println("resume corohandle addr {:#010x}", reinterpret_cast<uintptr_t>(t.address()));
+        TRACE("resume corohandle addr {:#010x}", reinterpret_cast<uintptr_t>(t.address()));
         if(!t.done()) t.resume();
 
-        return !tasks.empty();
+        return nonempty != 0;
     }
 
-    auto suspend() {
-        struct awaiter: std::suspend_always {
-            Scheduler & s;
-            explicit awaiter(Scheduler&sched) : s{sched} {}
-            void await_suspend(std::coroutine_handle<> coro) const noexcept { 
-                s.tasks.push_back(coro); 
-                std::println("suspend size {} corohandle addr {:#010x}", s.tasks.size(), reinterpret_cast<uintptr_t>(coro.address()));
-            }
-        };
-        return awaiter{*this};
+    // Awaiters are members rather than local classes, their await_suspend() is a
+    // template over the promise type so traced tasks can report to the table.
+    struct suspend_awaiter: std::suspend_always {
+        Scheduler & s;
+        Priority priority;
+        TaskSlot * slot = nullptr;
+        suspend_awaiter(Scheduler&sched, Priority p) : s{sched}, priority{p} {}
+        // Inlined at each co_await so the priority folds to a constant there.
+        template <typename P>
+        [[gnu::always_inline]] void await_suspend(std::coroutine_handle<P> coro) noexcept {
+            s.suspend(coro, priority);
+            TRACE("suspend size {} corohandle addr {:#010x}", s.tasks_count(), reinterpret_cast<uintptr_t>(coro.address()));
+            task_park(slot, &s.table, coro, WaitReason::RUNNABLE);
+        }
+        [[gnu::always_inline]] void await_resume() const noexcept { task_resume(slot); }
+    };
+
+    struct deadline_awaiter: std::suspend_always {
+        Scheduler & s;
+        std::chrono::steady_clock::time_point deadline;
+        TaskSlot * slot = nullptr;
+        template <typename P>
+        void await_suspend(std::coroutine_handle<P> coro) noexcept {
+            s.suspend_until(coro, deadline);
+            task_park(slot, &s.table, coro, WaitReason::DEADLINE);
+        }
+        void await_resume() const noexcept { task_resume(slot); }
+    };
+
+    auto suspend(Priority priority = Priority::NORMAL) { return suspend_awaiter{*this, priority}; }
+
+    // Requeues the task to be resumed by deadline, earliest deadline first.
+    auto yield_until(std::chrono::steady_clock::time_point deadline) { return deadline_awaiter{{}, *this, deadline}; }
+
+    [[gnu::always_inline]] void suspend(std::coroutine_handle<> coro, Priority priority = Priority::NORMAL) {
+        const size_t level = static_cast<size_t>(priority);
+        levels[level].push_back(coro);
+        nonempty |= level_bit(level);
     }
 
-    auto suspend(std::coroutine_handle<> coro) { tasks.push_back(coro); }
+    void suspend_until(std::coroutine_handle<> coro, std::chrono::steady_clock::time_point deadline) {
+        deadlines.push_back({deadline, coro});
+        std::push_heap(deadlines.begin(), deadlines.end(), Deadline::later);
+        nonempty |= DEADLINES_BIT;
+    }
 };
 
 struct Task {
-    struct promise_type {
+    struct promise_type : PooledPromise, TracedPromise {
         Task get_return_object() { return {}; }
         std::suspend_never initial_suspend() noexcept { return {}; }
         std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
         void unhandled_exception() {}
     };
 };
@@ -45,15 +226,396 @@ struct Task {
 Scheduler gScheduler;
 
 struct suspend { 
+    struct awaiter : std::suspend_always {
+        TaskSlot * slot = nullptr;
+        template <typename P>
+        void await_suspend(std::coroutine_handle<P> coro) noexcept {
+            gScheduler.suspend(coro);
+            task_park(slot, &gScheduler.task_table(), coro, WaitReason::RUNNABLE);
+        }
+        void await_resume() const noexcept { task_resume(slot); }
+    };
+
     auto operator co_await() {
-        struct awaiter : std::suspend_always {
-            void await_suspend(std::coroutine_handle<> coro) const noexcept { gScheduler.suspend(coro); } 
-        };
-    
         return awaiter{};
     }
 };
 
+// Bounded multi-producer multi-consumer channel between tasks of one Scheduler.
+// Values are moved in and out, never copied. A full channel parks senders and
+// an empty one parks receivers, both in FIFO order, and whoever unblocks a
+// waiter hands the value over directly and puts the waiter back on the
+// Scheduler. Capacity 0 makes every send a rendezvous with a receiver. After
+// close() sends fail and receivers drain what is buffered, then get nothing.
+template <typename T>
+class Channel {
+private:
+    struct receiver {
+        receiver * next = nullptr;
+        std::coroutine_handle<> handle{};
+        TaskSlot * slot = nullptr;
+        std::optional<T> value{};
+        // recv_many() appends here instead of filling value.
+        std::vector<T> * batch = nullptr;
+        size_t max = 1;
+        size_t received = 0;
+
+        void deliver(T && v) {
+            if (batch) batch->push_back(std::move(v));
+            else value.emplace(std::move(v));
+            ++received;
+        }
+    };
+
+    struct sender {
+        sender * next = nullptr;
+        std::coroutine_handle<> handle{};
+        T value;
+        bool sent = true;
+        TaskSlot * slot = nullptr;
+    };
+
+    template <typename W>
+    struct waitlist {
+        W * head = nullptr;
+        W * tail = nullptr;
+        bool empty() const { return head == nullptr; }
+        void push(W * w) {
+            w->next = nullptr;
+            (tail ? tail->next : head) = w;
+            tail = w;
+        }
+        W * pop() {
+            W * w = head;
+            head = w->next;
+            if (!head) tail = nullptr;
+            return w;
+        }
+    };
+
+    Scheduler & sched;
+    std::allocator<T> alloc{};
+    T * buf;
+    const size_t capacity;
+    size_t head = 0;
+    size_t count = 0;
+    bool closed = false;
+    waitlist<sender> senders{};
+    waitlist<receiver> receivers{};
+
+    struct send_awaiter : sender {
+        Channel & ch;
+        send_awaiter(Channel & c, T && v) : sender{nullptr, {}, std::move(v), true, nullptr}, ch{c} {}
+        bool await_ready() { return ch.try_send(*this); }
+        template <typename P>
+        void await_suspend(std::coroutine_handle<P> coro) {
+            this->handle = coro;
+            ch.senders.push(this);
+            task_park(this->slot, &ch.sched.task_table(), coro, WaitReason::SEND);
+        }
+        bool await_resume() const {
+            task_resume(this->slot);
+            return this->sent;
+        }
+    };
+
+    struct recv_awaiter : receiver {
+        Channel & ch;
+        explicit recv_awaiter(Channel & c) : ch{c} {}
+        bool await_ready() { return ch.try_recv(*this); }
+        template <typename P>
+        void await_suspend(std::coroutine_handle<P> coro) {
+            this->handle = coro;
+            ch.receivers.push(this);
+            task_park(this->slot, &ch.sched.task_table(), coro, WaitReason::RECV);
+        }
+        std::optional<T> await_resume() {
+            task_resume(this->slot);
+            return std::move(this->value);
+        }
+    };
+
+    struct recv_many_awaiter : recv_awaiter {
+        recv_many_awaiter(Channel & c, std::vector<T> & o, size_t m) : recv_awaiter{c} {
+            this->batch = &o;
+            this->max = m;
+        }
+        size_t await_resume() const {
+            task_resume(this->slot);
+            return this->received;
+        }
+    };
+
+    // Puts a parked sender or receiver back on the Scheduler.
+    template <typename W>
+    void wake(W * w) {
+        task_wake(w->slot);
+        sched.suspend(w->handle);
+    }
+
+    void push_back(T && v) {
+        std::construct_at(buf + (head + count++) % capacity, std::move(v));
+    }
+
+    T pop_front() {
+        T v = std::move(buf[head]);
+        std::destroy_at(buf + head);
+        head = (head + 1) % capacity;
+        --count;
+        return v;
+    }
+
+    bool try_send(sender & s) {
+        if (closed) {
+            s.sent = false;
+            return true;
+        }
+        // Receivers only wait on an empty buffer, so handing over keeps FIFO order.
+        if (!receivers.empty()) {
+            receiver * r = receivers.pop();
+            r->deliver(std::move(s.value));
+            wake(r);
+            return true;
+        }
+        if (count < capacity) {
+            push_back(std::move(s.value));
+            return true;
+        }
+        return false;
+    }
+
+    bool try_recv(receiver & r) {
+        while (r.received < r.max) {
+            if (count > 0) {
+                r.deliver(pop_front());
+                if (!senders.empty()) {
+                    sender * s = senders.pop();
+                    push_back(std::move(s->value));
+                    wake(s);
+                }
+            } else if (!senders.empty()) {
+                sender * s = senders.pop();
+                r.deliver(std::move(s->value));
+                wake(s);
+            } else {
+                break;
+            }
+        }
+        return r.received > 0 || closed;
+    }
+
+public:
+    Channel(Scheduler & s, size_t cap) : sched{s}, buf{cap ? alloc.allocate(cap) : nullptr}, capacity{cap} {}
+    Channel(const Channel &) = delete;
+    Channel & operator=(const Channel &) = delete;
+
+    ~Channel() {
+        while (count > 0) pop_front();
+        if (buf) alloc.deallocate(buf, capacity);
+    }
+
+    size_t size() const { return count; }
+    bool is_closed() const { return closed; }
+
+    // co_await yields false when the channel was closed and the value was dropped.
+    auto send(T value) { return send_awaiter{*this, std::move(value)}; }
+
+    // co_await yields std::nullopt once the channel is closed and drained.
+    auto recv() { return recv_awaiter{*this}; }
+
+    // Appends between 1 and max values to out, waiting only while the channel
+    // is empty. co_await yields the number appended, 0 once closed and drained.
+    auto recv_many(std::vector<T> & out, size_t max) { return recv_many_awaiter{*this, out, std::max<size_t>(1, max)}; }
+
+    // Wakes every waiter: parked senders fail, parked receivers find nothing.
+    void close() {
+        closed = true;
+        while (!receivers.empty()) wake(receivers.pop());
+        while (!senders.empty()) {
+            sender * s = senders.pop();
+            s->sent = false;
+            wake(s);
+        }
+    }
+};
+
+// Ring with a fixed power-of-two capacity and the push and steal sides of a
+// Chase-Lev deque, but not its owner path. Only the owning worker pushes, and
+// the owner takes from the top with the same seq_cst CAS as the thieves
+// instead of popping the bottom without one. Every local pop pays for that
+// CAS, in exchange each worker drains its queue in FIFO order like Scheduler
+// does: with a LIFO owner a coroutine that suspends to let the others run
+// would be resumed again right away.
+class StealDeque {
+private:
+    std::unique_ptr<std::atomic<void*>[]> buf;
+    const int64_t mask;
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+
+public:
+    explicit StealDeque(int64_t capacity) : buf{std::make_unique<std::atomic<void*>[]>(capacity)}, mask{capacity - 1} {}
+
+    // Owner only. Returns false when the deque is full.
+    bool push(std::coroutine_handle<> h) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        if (b - t > mask) return false;
+        buf[b & mask].store(h.address(), std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::coroutine_handle<> steal() {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) return nullptr;
+        void * addr = buf[t & mask].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return nullptr;
+        return std::coroutine_handle<>::from_address(addr);
+    }
+};
+
+// Pool of worker threads, each with its own StealDeque. A worker runs its own
+// queue first, then steals from the others, then falls back to the shared
+// injection queue that collects handles suspended from non-worker threads and
+// local overflow. Any handle may be resumed on any worker. A worker that finds
+// nothing for IDLE_SPINS rounds parks until suspend() queues a handle.
+class WorkStealingScheduler {
+private:
+    struct Worker {
+        StealDeque deque;
+        uint64_t seed;
+        explicit Worker(uint64_t s) : deque{1 << 16}, seed{s} {}
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers{};
+    std::vector<std::thread> threads{};
+    std::mutex injected_mutex{};
+    ReadyQueue injected{};
+    std::atomic<bool> stopping{false};
+    // Parked workers, and the counter they wait on for the next wake_one().
+    std::atomic<size_t> sleeping{0};
+    std::atomic<uint32_t> wakeups{0};
+
+    static constexpr int IDLE_SPINS = 64;
+
+    static inline thread_local Worker * current = nullptr;
+
+    std::coroutine_handle<> take_injected() {
+        std::lock_guard lock{injected_mutex};
+        return injected.empty() ? nullptr : injected.pop_front();
+    }
+
+    std::coroutine_handle<> find_work(Worker & self) {
+        if (auto h = self.deque.steal()) return h;
+        // xorshift64 picks the first victim so idle workers do not all hit the same queue.
+        self.seed ^= self.seed << 13;
+        self.seed ^= self.seed >> 7;
+        self.seed ^= self.seed << 17;
+        size_t n = workers.size();
+        for (size_t i = 0, start = self.seed % n; i < n; ++i) {
+            Worker & victim = *workers[(start + i) % n];
+            if (&victim == &self) continue;
+            if (auto h = victim.deque.steal()) return h;
+        }
+        return take_injected();
+    }
+
+    // Registers as sleeping before the last look for work, wake_one() checks
+    // for sleepers after it queued a handle, so one of the two sees the other.
+    std::coroutine_handle<> park(Worker & self) {
+        const uint32_t seen = wakeups.load(std::memory_order_acquire);
+        sleeping.fetch_add(1, std::memory_order_seq_cst);
+        std::coroutine_handle<> h = find_work(self);
+        if (!h && !stopping.load(std::memory_order_relaxed)) {
+            wakeups.wait(seen, std::memory_order_acquire);
+        }
+        sleeping.fetch_sub(1, std::memory_order_relaxed);
+        return h;
+    }
+
+    void wake_one() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_relaxed) > 0) {
+            wakeups.fetch_add(1, std::memory_order_release);
+            wakeups.notify_one();
+        }
+    }
+
+    void run(Worker & self) {
+        current = &self;
+        int idle = 0;
+        while (!stopping.load(std::memory_order_relaxed)) {
+            std::coroutine_handle<> h = find_work(self);
+            if (!h && ++idle >= IDLE_SPINS) {
+                h = park(self);
+                idle = 0;
+            }
+            if (h) {
+                idle = 0;
+                TRACE("resume corohandle addr {:#010x}", reinterpret_cast<uintptr_t>(h.address()));
+                if (!h.done()) h.resume();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        current = nullptr;
+    }
+
+public:
+    explicit WorkStealingScheduler(size_t num_threads = std::thread::hardware_concurrency()) {
+        num_threads = std::max<size_t>(1, num_threads);
+        for (size_t i = 0; i < num_threads; ++i) {
+            workers.push_back(std::make_unique<Worker>(0x9E3779B97F4A7C15ull * (i + 1)));
+        }
+        for (size_t i = 0; i < num_threads; ++i) {
+            threads.emplace_back([this, i] { run(*workers[i]); });
+        }
+    }
+
+    ~WorkStealingScheduler() { stop(); }
+
+    WorkStealingScheduler(const WorkStealingScheduler &) = delete;
+    WorkStealingScheduler & operator=(const WorkStealingScheduler &) = delete;
+
+    size_t threads_count() const { return workers.size(); }
+
+    // Joins the workers and destroys the coroutines still queued, nothing would resume them.
+    void stop() {
+        stopping.store(true, std::memory_order_relaxed);
+        wakeups.fetch_add(1, std::memory_order_release);
+        wakeups.notify_all();
+        for (auto & t : threads) {
+            if (t.joinable()) t.join();
+        }
+        for (auto & w : workers) {
+            while (auto h = w->deque.steal()) h.destroy();
+        }
+        while (auto h = take_injected()) h.destroy();
+    }
+
+    void suspend(std::coroutine_handle<> coro) {
+        if (!current || !current->deque.push(coro)) {
+            std::lock_guard lock{injected_mutex};
+            injected.push_back(coro);
+        }
+        wake_one();
+    }
+
+    auto suspend() {
+        struct awaiter: std::suspend_always {
+            WorkStealingScheduler & s;
+            explicit awaiter(WorkStealingScheduler & sched) : s{sched} {}
+            void await_suspend(std::coroutine_handle<> coro) const noexcept { 
+                s.suspend(coro);
+                TRACE("suspend corohandle addr {:#010x}", reinterpret_cast<uintptr_t>(coro.address()));
+            }
+        };
+        return awaiter{*this};
+    }
+};
 
 template <char TaskName>
 Task task(Scheduler &s) {
@@ -76,18 +638,397 @@ Task task() {
 
 void use_sched_1() {
     Scheduler s;
+    auto scope = s.arena_scope();
     task<'1'>(s);
     task<'2'>(s);
     while (s.schedule());
 }
 
+Task chat_producer(Channel<std::string> &ch, std::string_view name, int &live) {
+    for (int i = 0; i < 3; ++i) {
+        co_await ch.send(std::string{name} + " says hello " + std::to_string(i));
+    }
+    if (--live == 0) ch.close();
+}
+
+Task chat_consumer(Channel<std::string> &ch, char name) {
+    while (std::optional<std::string> msg = co_await ch.recv()) {
+        std::println("consumer {} got '{}'", name, *msg);
+    }
+    std::println("consumer {} done", name);
+}
+
+// Two producers and two consumers over a channel with room for one message.
+void use_channel() {
+    Scheduler s;
+    Channel<std::string> ch{s, 1};
+    int live = 2;
+    chat_consumer(ch, 'A');
+    chat_consumer(ch, 'B');
+    chat_producer(ch, "alice", live);
+    chat_producer(ch, "bob", live);
+    while (s.tasks_count() && s.schedule());
+}
+
 void use_sched_2() {
     task<'1'>();
     task<'2'>();
     while (gScheduler.schedule());
 }
 
-int main() {
+Task bench_task(Scheduler &s, long rounds) {
+    while (rounds--) {
+        co_await s.suspend();
+    }
+}
+
+// Task without the TaskTable hooks, the awaiters compile them out for its promise.
+struct UntracedTask {
+    struct promise_type : PooledPromise {
+        UntracedTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() {}
+    };
+};
+
+UntracedTask untraced_bench_task(Scheduler &s, long rounds) {
+    while (rounds--) {
+        co_await s.suspend();
+    }
+}
+
+// ns per co_await s.suspend() round trip (suspend, queue, resume) with live_tasks tasks in flight.
+void bench_suspend(long live_tasks, long switches) {
+    Scheduler s;
+    long rounds = std::max(1L, switches / live_tasks);
+    for (long i = 0; i < live_tasks; ++i) {
+        bench_task(s, rounds);
+    }
+    auto start = std::chrono::steady_clock::now();
+    while (s.schedule());
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    std::println("tasks {:>8} switches {:>9} {:.1f} ns/switch", live_tasks, live_tasks * rounds, ns / (live_tasks * rounds));
+}
+
+Task channel_producer(Channel<long> &ch, long messages, long &live) {
+    for (long i = 0; i < messages; ++i) {
+        co_await ch.send(i);
+    }
+    if (--live == 0) ch.close();
+}
+
+Task channel_consumer(Channel<long> &ch, long &received, size_t batch) {
+    if (batch > 1) {
+        std::vector<long> values;
+        while (size_t n = co_await ch.recv_many(values, batch)) {
+            received += n;
+            values.clear();
+        }
+        co_return;
+    }
+    while (co_await ch.recv()) {
+        ++received;
+    }
+}
+
+// Runs producers x consumers over one channel until it is closed and drained, returns the messages delivered.
+long channel_round(long producers, long consumers, long messages, size_t capacity, size_t batch) {
+    Scheduler s;
+    Channel<long> ch{s, capacity};
+    long live = producers;
+    long received = 0;
+    for (long i = 0; i < consumers; ++i) {
+        channel_consumer(ch, received, batch);
+    }
+    for (long i = 0; i < producers; ++i) {
+        channel_producer(ch, messages / producers, live);
+    }
+    while (s.tasks_count() && s.schedule());
+    return received;
+}
+
+void bench_channel(long producers, long consumers, long messages, size_t capacity, size_t batch) {
+    auto start = std::chrono::steady_clock::now();
+    long received = channel_round(producers, consumers, messages, capacity, batch);
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::println("channel {}:{} capacity {} batch {} {:.0f} messages/s", producers, consumers, capacity, batch, received / secs);
+}
+
+Task prioritized_task(Scheduler &s, long rounds, Priority priority) {
+    while (rounds--) {
+        co_await s.suspend(priority);
+    }
+}
+
+Task deadline_task(Scheduler &s, long rounds, std::chrono::microseconds slack) {
+    while (rounds--) {
+        co_await s.yield_until(std::chrono::steady_clock::now() + slack);
+    }
+}
+
+// How an urgent task requeues itself: behind the bulk work, at Priority::HIGH or with a deadline.
+enum class Urgency { FIFO, PRIORITY, DEADLINE };
+
+static constexpr std::chrono::microseconds URGENT_SLACK{20};
+
+// Idles behind the bulk work, then wakes and measures how long it waits to be resumed.
+Task urgent_task(Scheduler &s, std::vector<uint64_t> &latencies, long rounds, Urgency urgency) {
+    while (rounds--) {
+        co_await s.suspend(Priority::LOW);
+        auto queued = std::chrono::steady_clock::now();
+        switch (urgency) {
+        case Urgency::FIFO: co_await s.suspend(Priority::LOW); break;
+        case Urgency::PRIORITY: co_await s.suspend(Priority::HIGH); break;
+        case Urgency::DEADLINE: co_await s.yield_until(queued + URGENT_SLACK); break;
+        }
+        latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - queued).count());
+    }
+}
+
+// Scheduling latency of urgent tasks among background tasks that all requeue at Priority::LOW.
+void bench_priority(long background, long urgent, long rounds, Urgency urgency) {
+    Scheduler s;
+    std::vector<uint64_t> latencies;
+    latencies.reserve(urgent * rounds);
+    for (long i = 0; i < background; ++i) {
+        prioritized_task(s, rounds, Priority::LOW);
+    }
+    for (long i = 0; i < urgent; ++i) {
+        urgent_task(s, latencies, rounds, urgency);
+    }
+    while (s.schedule());
+    std::ranges::sort(latencies);
+    auto percentile = [&](double q) { return latencies[std::min(latencies.size() - 1, static_cast<size_t>(q * latencies.size()))]; };
+    static constexpr std::string_view names[] = {"fifo", "priority", "deadline"};
+    std::println("{:<8} {} urgent among {} background: p50 {} ns p99 {} ns max {} ns, deadlines missed {}",
+        names[static_cast<int>(urgency)], urgent, background, percentile(0.5), percentile(0.99), latencies.back(), s.deadlines_missed());
+}
+
+Task spinning_task(Scheduler &s, const bool &stop, Priority priority, long &runs) {
+    while (!stop) {
+        ++runs;
+        co_await s.suspend(priority);
+    }
+}
+
+// Share of picks that aging leaves to Priority::LOW while HIGH tasks are always runnable.
+void bench_aging(long high, long low, long picks) {
+    Scheduler s;
+    bool stop = false;
+    long high_runs = 0;
+    long low_runs = 0;
+    for (long i = 0; i < high; ++i) {
+        spinning_task(s, stop, Priority::HIGH, high_runs);
+    }
+    for (long i = 0; i < low; ++i) {
+        spinning_task(s, stop, Priority::LOW, low_runs);
+    }
+    for (long i = 0; i < picks; ++i) {
+        s.schedule();
+    }
+    stop = true;
+    while (s.schedule());
+    std::println("aging: {} always runnable HIGH tasks, {} LOW tasks got {:.2f}% of {} picks", high, low, 100.0 * low_runs / (low_runs + high_runs), picks);
+}
+
+Task busy_task(Scheduler &s, long rounds, long work) {
+    while (rounds--) {
+        uint64_t x = work;
+        for (long i = 0; i < work; ++i) {
+            x = x * 6364136223846793005ull + 1442695040888963407ull;
+        }
+        bench_keep(x);
+        co_await s.suspend();
+    }
+}
+
+// Read by the SIGPROF handler of bench_introspection().
+static std::atomic<const TaskTable*> gProfiled{nullptr};
+static std::array<TaskSample, 3> gSlowest{};
+static std::atomic<size_t> gSlowestCount{0};
+static std::atomic<long> gProfiles{0};
+
+void profile_slowest(int) {
+    if (const TaskTable * table = gProfiled.load(std::memory_order_acquire)) {
+        gSlowestCount.store(table->slowest(gSlowest), std::memory_order_relaxed);
+        gProfiles.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Switch cost while a side thread takes snapshots every 100 us and a SIGPROF
+// handler asks for the slowest tasks every ms of CPU time. One task in 64
+// burns 100 times the CPU of the others per resume.
+void bench_introspection(long tasks, long switches) {
+    Scheduler s;
+    const long rounds = std::max(1L, switches / tasks);
+    for (long i = 0; i < tasks; ++i) {
+        busy_task(s, rounds, i % 64 ? 20 : 2000);
+    }
+    std::atomic<bool> done{false};
+    long snapshots = 0;
+    TaskCounts counts{};
+    std::thread observer([&] {
+        // The handler is meant to interrupt the scheduler thread.
+        sigset_t prof;
+        sigemptyset(&prof);
+        sigaddset(&prof, SIGPROF);
+        pthread_sigmask(SIG_BLOCK, &prof, nullptr);
+        std::vector<TaskSample> samples(TASK_SLOTS);
+        while (!done.load(std::memory_order_relaxed)) {
+            s.task_table().snapshot(samples);
+            counts = s.task_table().counts();
+            ++snapshots;
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+    struct sigaction action{};
+    action.sa_handler = profile_slowest;
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGPROF, &action, nullptr);
+    gProfiled.store(&s.task_table(), std::memory_order_release);
+    itimerval every_ms{{0, 1000}, {0, 1000}};
+    setitimer(ITIMER_PROF, &every_ms, nullptr);
+
+    auto start = std::chrono::steady_clock::now();
+    while (s.schedule());
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    itimerval off{};
+    setitimer(ITIMER_PROF, &off, nullptr);
+    gProfiled.store(nullptr, std::memory_order_release);
+    done = true;
+    observer.join();
+    std::println("introspection: {} tasks {:.1f} ns/switch, {} snapshots, last {} running {} runnable {} blocked, {} SIGPROF queries",
+        tasks, ns / (tasks * rounds), snapshots, counts.running, counts.runnable, counts.blocked, gProfiles.load());
+    for (size_t i = 0; i < gSlowestCount.load(); ++i) {
+        std::println("  slowest {}: task {} {} ns per run over {} runs", i + 1, gSlowest[i].id, gSlowest[i].mean_run_ns, gSlowest[i].runs);
+    }
+}
+
+// Fan-out tree: every node first hops onto the pool, inner nodes spawn fanout
+// children and leaves burn a fixed amount of CPU.
+Task tree_task(WorkStealingScheduler &s, std::atomic<long> &leaves_done, int depth, int fanout, long work) {
+    co_await s.suspend();
+    if (depth == 0) {
+        uint64_t x = work;
+        for (long i = 0; i < work; ++i) {
+            x = x * 6364136223846793005ull + 1442695040888963407ull;
+        }
+        bench_keep(x);
+        leaves_done.fetch_add(1, std::memory_order_relaxed);
+        co_return;
+    }
+    for (int i = 0; i < fanout; ++i) {
+        tree_task(s, leaves_done, depth - 1, fanout, work);
+    }
+}
+
+void bench_scaling(size_t max_threads, int depth, int fanout, long work) {
+    long leaves = 1;
+    for (int i = 0; i < depth; ++i) leaves *= fanout;
+    std::vector<size_t> counts{};
+    for (size_t n = 1; n < max_threads; n *= 2) counts.push_back(n);
+    counts.push_back(max_threads);
+    for (size_t n : counts) {
+        std::atomic<long> leaves_done{0};
+        WorkStealingScheduler s{n};
+        auto start = std::chrono::steady_clock::now();
+        tree_task(s, leaves_done, depth, fanout, work);
+        while (leaves_done.load(std::memory_order_relaxed) < leaves) {
+            std::this_thread::yield();
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        s.stop();
+        std::println("threads {:>3} leaves {} {:.0f} leaves/s", n, leaves, leaves / secs);
+    }
+}
+
+// Switch cost on the single-threaded Scheduler per kind of ready queue and leaf throughput of the work-stealing pool.
+void suite() {
+    static constexpr long SWITCHES = 1000000;
+    BenchSuite bench{"coroscheduler"};
+    for (long live_tasks : {1L, 1000L}) {
+        bench.run(live_tasks == 1 ? "switch_1_task" : "switch_1000_tasks", SWITCHES, [=] {
+            Scheduler s;
+            for (long i = 0; i < live_tasks; ++i) {
+                bench_task(s, SWITCHES / live_tasks);
+            }
+            while (s.schedule());
+        });
+    }
+    // The same without the task table, built with -DTASK_STATS the difference
+    // is what introspection costs.
+    bench.run("switch_1000_untraced_tasks", SWITCHES, [] {
+        Scheduler s;
+        for (long i = 0; i < 1000; ++i) {
+            untraced_bench_task(s, SWITCHES / 1000);
+        }
+        while (s.schedule());
+    });
+    // One task per level, and one pushing through the deadline heap.
+    bench.run("switch_4_priorities", SWITCHES, [] {
+        Scheduler s;
+        for (Priority priority : {Priority::HIGH, Priority::NORMAL, Priority::LOW, Priority::IDLE}) {
+            prioritized_task(s, SWITCHES / 4, priority);
+        }
+        while (s.schedule());
+    });
+    bench.run("switch_deadline_1000_tasks", SWITCHES, [] {
+        Scheduler s;
+        for (long i = 0; i < 1000; ++i) {
+            deadline_task(s, SWITCHES / 1000, URGENT_SLACK);
+        }
+        while (s.schedule());
+    });
+    const size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    WorkStealingScheduler pool{threads};
+    static constexpr int DEPTH = 5;
+    static constexpr int FANOUT = 8;
+    static constexpr long LEAVES = 8 * 8 * 8 * 8 * 8;
+    static constexpr long MESSAGES = 1000000;
+    bench.run("channel_1_1", MESSAGES, [] { channel_round(1, 1, MESSAGES, 64, 1); });
+    bench.run("channel_8_1", MESSAGES, [] { channel_round(8, 1, MESSAGES, 64, 1); });
+    bench.run("channel_8_8", MESSAGES, [] { channel_round(8, 8, MESSAGES, 64, 1); });
+    bench.run("channel_8_8_recv_many", MESSAGES, [] { channel_round(8, 8, MESSAGES, 64, 64); });
+    bench.run("work_stealing_leaf", LEAVES, [&] {
+        std::atomic<long> leaves_done{0};
+        tree_task(pool, leaves_done, DEPTH, FANOUT, 2000);
+        while (leaves_done.load(std::memory_order_relaxed) < LEAVES) {
+            std::this_thread::yield();
+        }
+    });
+}
+
+int main(int argc, char ** argv) {
+    if (argc > 1 && std::string_view{argv[1]} == "suite") {
+        suite();
+        return 0;
+    }
+    if (argc > 1 && std::string_view{argv[1]} == "bench") {
+        for (long live_tasks : {1L, 1000L, 1000000L}) {
+            bench_suspend(live_tasks, 4000000);
+        }
+        bench_scaling(std::max(1u, std::thread::hardware_concurrency()), 6, 8, 2000);
+        for (auto [producers, consumers] : {std::pair{1L, 1L}, {8L, 1L}, {8L, 8L}}) {
+            bench_channel(producers, consumers, 4000000, 64, 1);
+        }
+        bench_channel(8, 8, 4000000, 64, 64);
+        bench_channel(1, 1, 4000000, 0, 1);
+        for (Urgency urgency : {Urgency::FIFO, Urgency::PRIORITY, Urgency::DEADLINE}) {
+            bench_priority(100000, 64, 20, urgency);
+        }
+        bench_aging(8, 1000, 4000000);
+        if constexpr (TASK_STATS_ENABLED) {
+            bench_introspection(1000, 4000000);
+        }
+        return 0;
+    }
+    if (argc > 1 && std::string_view{argv[1]} == "channel") {
+        use_channel();
+        return 0;
+    }
     use_sched_1();
     return 0;
 }
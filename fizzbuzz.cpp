@@ -1,11 +1,24 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
 #include <coroutine>
+#include <cstdint>
 #include <iostream> 
 #include <optional>
+#include <ranges>
+#include <span>
+#include <string_view>
+#include <thread>
 #include <utility>
+#include <vector>
+
+#include "bench.h"
+#include "framepool.h"
 
 class Generator {
 public:
-    class promise_type {
+    class promise_type : public PooledPromise {
     public:
         Generator get_return_object() {
             //std::cout << "get_return_object " << std::hex << this << std::endl;
@@ -69,6 +82,252 @@ private:
     }
 };
 
+// Refers to the nested generator, yield_value() takes its frame over.
+template <typename G>
+struct elements_of {
+    G && m_generator;
+};
+
+template <typename G>
+elements_of(G &&) -> elements_of<G>;
+
+// Generator that can delegate to a nested one with co_yield elements_of{inner}.
+// The root promise tracks the innermost active frame (the leaf): next() resumes
+// the leaf directly and a finished leaf hands control back to its parent by
+// symmetric transfer, so an element costs one resume at any nesting depth.
+class RecursiveGenerator {
+public:
+    class promise_type : public PooledPromise {
+    public:
+        RecursiveGenerator get_return_object() {
+            return RecursiveGenerator(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        auto final_suspend() noexcept {
+            struct awaiter : std::suspend_always {
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                    promise_type & p = h.promise();
+                    if (!p.m_parent) {
+                        return std::noop_coroutine();
+                    }
+                    p.m_root->m_leaf = p.m_parent;
+                    return std::coroutine_handle<promise_type>::from_promise(*p.m_parent);
+                }
+            };
+            return awaiter{};
+        }
+
+        std::suspend_always yield_value(int value) noexcept {
+            m_root->m_value = value;
+            return {};
+        }
+
+        auto yield_value(elements_of<RecursiveGenerator> nested) noexcept {
+            struct awaiter {
+                promise_type & m_parent;
+                bool await_ready() const noexcept { return !m_parent.m_child; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type>) noexcept {
+                    promise_type & child = m_parent.m_child.promise();
+                    child.m_root = m_parent.m_root;
+                    child.m_parent = &m_parent;
+                    m_parent.m_root->m_leaf = &child;
+                    return m_parent.m_child;
+                }
+                void await_resume() noexcept { m_parent.destroy_child(); }
+            };
+            destroy_child();
+            m_child = std::exchange(nested.m_generator.m_cohandle, nullptr);
+            return awaiter{*this};
+        }
+
+        ~promise_type() { destroy_child(); }
+
+        void destroy_child() {
+            if (m_child) {
+                std::exchange(m_child, nullptr).destroy();
+            }
+        }
+
+        void unhandled_exception() {}
+        void return_void() {}
+
+        int m_value;
+        promise_type * m_root = this;
+        promise_type * m_parent = nullptr;
+        promise_type * m_leaf = this;
+        std::coroutine_handle<promise_type> m_child;
+    };
+
+public:
+    std::optional<int> next() {
+        if (!m_cohandle || m_cohandle.done()) {
+            return std::nullopt;
+        }
+        std::coroutine_handle<promise_type>::from_promise(*m_cohandle.promise().m_leaf).resume();
+        if (m_cohandle.done()) {
+            return std::nullopt;
+        }
+        return m_cohandle.promise().m_value;
+    }
+
+private:
+    explicit RecursiveGenerator(const std::coroutine_handle<promise_type> cohandle) : m_cohandle(cohandle) {}
+    std::coroutine_handle<promise_type> m_cohandle;
+
+public:
+    RecursiveGenerator(RecursiveGenerator && other) : m_cohandle{std::exchange(other.m_cohandle, nullptr)} {}
+
+    RecursiveGenerator& operator=(RecursiveGenerator && other) {
+        if (this != &other) {
+            if(m_cohandle) {
+                m_cohandle.destroy();
+            }
+            m_cohandle = std::exchange(other.m_cohandle, nullptr);
+        }
+        return *this;
+    }
+
+    ~RecursiveGenerator() {
+        if (m_cohandle) {
+            m_cohandle.destroy();
+        }
+    }
+};
+
+static constexpr size_t BATCH_SIZE = 1024;
+
+struct batch_buffer {};
+
+// Generator that yields whole batches. The body gets a BATCH_SIZE scratch
+// buffer owned by the promise with 'co_await batch_buffer{}', fills it and
+// yields the filled prefix as a span, so one resume moves up to BATCH_SIZE
+// elements. Consumers either pull spans with next_batch() or iterate the
+// flattened elements with a range-for. Empty batches are skipped, so an empty
+// span from next_batch() always means the end.
+template <typename T>
+class BatchGenerator {
+public:
+    class promise_type : public PooledPromise {
+    public:
+        BatchGenerator get_return_object() {
+            return BatchGenerator(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        std::suspend_always yield_value(std::span<const T> batch) noexcept {
+            m_batch = batch;
+            return {};
+        }
+
+        auto await_transform(batch_buffer) {
+            struct awaiter {
+                promise_type & m_promise;
+                bool await_ready() const noexcept { return true; }
+                void await_suspend(std::coroutine_handle<>) const noexcept {}
+                std::span<T> await_resume() const noexcept { return m_promise.m_buffer; }
+            };
+            m_buffer.resize(BATCH_SIZE);
+            return awaiter{*this};
+        }
+
+        void unhandled_exception() {}
+        void return_void() {}
+
+        std::vector<T> m_buffer;
+        std::span<const T> m_batch;
+    };
+
+public:
+    // The span stays valid until the generator is resumed again, empty once it is exhausted.
+    std::span<const T> next_batch() {
+        if (!m_cohandle) {
+            return {};
+        }
+        while (!m_cohandle.done()) {
+            m_cohandle.resume();
+            if (!m_cohandle.done() && !m_cohandle.promise().m_batch.empty()) {
+                return m_cohandle.promise().m_batch;
+            }
+        }
+        return {};
+    }
+
+    struct sentinel {};
+    class iterator {
+    public:
+        explicit iterator(BatchGenerator * generator) : m_generator{generator} { refill(); }
+        bool operator==(sentinel) const { return m_pos == m_batch.end(); }
+        iterator & operator++() {
+            if (++m_pos == m_batch.end()) {
+                refill();
+            }
+            return *this;
+        }
+        const T & operator*() const { return *m_pos; }
+
+    private:
+        void refill() {
+            m_batch = m_generator->next_batch();
+            m_pos = m_batch.begin();
+        }
+
+        BatchGenerator * m_generator;
+        std::span<const T> m_batch;
+        std::span<const T>::iterator m_pos;
+    };
+
+    iterator begin() { return iterator{this}; }
+    sentinel end() { return {}; }
+
+private:
+    explicit BatchGenerator(const std::coroutine_handle<promise_type> cohandle) : m_cohandle(cohandle) {}
+    std::coroutine_handle<promise_type> m_cohandle;
+
+public:
+    BatchGenerator(BatchGenerator && other) : m_cohandle{std::exchange(other.m_cohandle, nullptr)} {}
+
+    BatchGenerator& operator=(BatchGenerator && other) {
+        if (this != &other) {
+            if(m_cohandle) {
+                m_cohandle.destroy();
+            }
+            m_cohandle = std::exchange(other.m_cohandle, nullptr);
+        }
+        return *this;
+    }
+
+    ~BatchGenerator() {
+        if (m_cohandle) {
+            m_cohandle.destroy();
+        }
+    }
+};
+
+// Divisibility by a constant without a division: for odd d, x % d == 0 exactly
+// when x * d^-1 (mod 2^32) <= (2^32 - 1) / d. Multiplies vectorize, divides do not.
+struct Divisor {
+    explicit Divisor(uint32_t d) : m_shift{static_cast<uint32_t>(__builtin_ctz(d))} {
+        uint32_t odd = d >> m_shift;
+        uint32_t inverse = odd;
+        for (int i = 0; i < 4; ++i) {
+            inverse *= 2 - odd * inverse;
+        }
+        m_inverse = inverse;
+        m_limit = UINT32_MAX / odd;
+        m_low_mask = (1u << m_shift) - 1;
+    }
+
+    bool divides(uint32_t x) const {
+        return ((x & m_low_mask) == 0) & ((x >> m_shift) * m_inverse <= m_limit);
+    }
+
+    uint32_t m_shift;
+    uint32_t m_inverse;
+    uint32_t m_limit;
+    uint32_t m_low_mask;
+};
+
 Generator source(int end) {
     for(int x = 2; x < end; ++x) {
         co_yield x;
@@ -86,7 +345,514 @@ Generator filter(Generator g, int prime) {
     std::cout << "filter for prime " << prime << " finished\n";
 }
 
-int main() {
+// Recursive sieve: each level yields its prime, strikes the multiples from the
+// remaining candidates and delegates the rest to the next level. The nesting is
+// as deep as the filter chain, but every prime reaches the consumer in one resume.
+RecursiveGenerator sieve(std::vector<int> candidates) {
+    if (candidates.empty()) {
+        co_return;
+    }
+    int prime = candidates.front();
+    co_yield prime;
+    std::vector<int> rest;
+    for (int x : candidates) {
+        if ((x % prime) != 0) {
+            rest.push_back(x);
+        }
+    }
+    co_yield elements_of{sieve(std::move(rest))};
+}
+
+Generator forward(Generator g) {
+    while (std::optional<int> optional_x = g.next()) {
+        co_yield optional_x.value();
+    }
+}
+
+RecursiveGenerator counter(int end) {
+    for (int x = 0; x < end; ++x) {
+        co_yield x;
+    }
+}
+
+RecursiveGenerator delegate(RecursiveGenerator g) {
+    co_yield elements_of{std::move(g)};
+}
+
+// Per-element cost through depth layers: value-by-value forwarding vs elements_of.
+void bench_nesting(int depth, int elements) {
+    Generator g = source(elements + 2);
+    for (int i = 0; i < depth; ++i) {
+        g = forward(std::move(g));
+    }
+    auto start = std::chrono::steady_clock::now();
+    long sum = 0;
+    while (std::optional<int> x = g.next()) {
+        sum += x.value();
+    }
+    double forward_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / elements;
+
+    RecursiveGenerator r = counter(elements);
+    for (int i = 0; i < depth; ++i) {
+        r = delegate(std::move(r));
+    }
+    start = std::chrono::steady_clock::now();
+    while (std::optional<int> x = r.next()) {
+        sum += x.value();
+    }
+    double nested_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / elements;
+    std::cout << "depth " << depth << " forward " << forward_ns << " ns/element, elements_of " << nested_ns << " ns/element (sum " << sum << ")\n";
+}
+
+void bench_sieve(int end) {
+    std::streambuf * cout_buf = std::cout.rdbuf(nullptr);
+    auto start = std::chrono::steady_clock::now();
+    int chain_primes = 0;
+    {
+        Generator g = source(end);
+        while (std::optional<int> optional_prime = g.next()) {
+            ++chain_primes;
+            g = filter(std::move(g), optional_prime.value());
+        }
+    }
+    double chain_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout.rdbuf(cout_buf);
+
+    start = std::chrono::steady_clock::now();
+    int nested_primes = 0;
+    {
+        std::vector<int> candidates;
+        for (int x = 2; x < end; ++x) {
+            candidates.push_back(x);
+        }
+        RecursiveGenerator g = sieve(std::move(candidates));
+        while (g.next()) {
+            ++nested_primes;
+        }
+    }
+    double nested_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "sieve " << end << " filter chain " << chain_primes << " primes " << chain_ms << " ms, elements_of "
+              << nested_primes << " primes " << nested_ms << " ms\n";
+}
+
+BatchGenerator<int> source_batched(int end) {
+    std::span<int> buf = co_await batch_buffer{};
+    for (int x = 2; x < end;) {
+        size_t n = 0;
+        for (; n < buf.size() && x < end; ++n, ++x) {
+            buf[n] = x;
+        }
+        co_yield buf.first(n);
+    }
+}
+
+// Filters pending first (what the caller had already pulled from g), then the
+// rest of g, one branch-free pass per batch.
+BatchGenerator<int> filter_batched(BatchGenerator<int> g, int prime, std::vector<int> pending) {
+    std::span<int> buf = co_await batch_buffer{};
+    const Divisor divisor(prime);
+    std::span<const int> batch = pending;
+    do {
+        size_t n = 0;
+        for (int x : batch) {
+            buf[n] = x;
+            n += !divisor.divides(x);
+        }
+        if (n) {
+            co_yield buf.first(n);
+        }
+        batch = g.next_batch();
+    } while (!batch.empty());
+}
+
+// Same filter as filter() without the tracing, the scalar baseline for the batched sieve.
+Generator filter_quiet(Generator g, int prime) {
+    while(std::optional<int> optional_x = g.next()) {
+        if ((optional_x.value() % prime) != 0) {
+            co_yield optional_x.value();
+        }
+    }
+}
+
+// Elements per second for the plain source and for the sieve up to end, scalar vs batched.
+void bench_batched(int end) {
+    auto start = std::chrono::steady_clock::now();
+    long sum = 0;
+    {
+        Generator g = source(end);
+        while (std::optional<int> x = g.next()) {
+            sum += x.value();
+        }
+    }
+    double scalar_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int x : source_batched(end)) {
+        sum -= x;
+    }
+    double batched_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "source " << end << " scalar " << (end - 2) / scalar_secs << " elements/s, batched "
+              << (end - 2) / batched_secs << " elements/s (check " << sum << ")\n";
+
+    const int sieve_end = end / 10;
+    start = std::chrono::steady_clock::now();
+    int scalar_primes = 0;
+    {
+        Generator g = source(sieve_end);
+        while (std::optional<int> optional_prime = g.next()) {
+            ++scalar_primes;
+            g = filter_quiet(std::move(g), optional_prime.value());
+        }
+    }
+    scalar_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    int batched_primes = 0;
+    {
+        BatchGenerator<int> g = source_batched(sieve_end);
+        for (std::span<const int> batch = g.next_batch(); !batch.empty(); batch = g.next_batch()) {
+            ++batched_primes;
+            g = filter_batched(std::move(g), batch.front(), std::vector<int>(batch.begin() + 1, batch.end()));
+        }
+    }
+    batched_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "sieve " << sieve_end << " scalar " << scalar_primes << " primes " << scalar_secs * 1000 << " ms, batched "
+              << batched_primes << " primes " << batched_secs * 1000 << " ms\n";
+}
+
+// Odd numbers per sieve segment, one bit each, so a segment's flags are 32 KiB and stay in L1d.
+static constexpr int64_t SEGMENT_BITS = 32 * 1024 * 8;
+static constexpr int64_t SEGMENT_SPAN = 2 * SEGMENT_BITS;
+
+// Segmented sieve of Eratosthenes for the odd primes below end. Worker threads
+// claim segments in increasing order and sieve each one into a slot of a ring;
+// the single consumer takes the slots back in segment order with acquire() and
+// release(). A slot's ticket is 2 * i while it is free for segment i and
+// 2 * i + 1 once segment i is sieved, so the workers run at most a ring ahead
+// of the consumer and neither side takes a lock.
+class SegmentedSieve {
+public:
+    SegmentedSieve(int end, unsigned threads)
+        : m_end{end}
+        , m_segments{std::max<int64_t>(0, (int64_t{end} + SEGMENT_SPAN - 1) / SEGMENT_SPAN)}
+        , m_slots(2 * threads + 1) {
+        int root = 1;
+        while (int64_t{root} * root < end) {
+            ++root;
+        }
+        std::vector<bool> composite(root + 1);
+        for (int p = 3; p <= root; p += 2) {
+            if (composite[p]) {
+                continue;
+            }
+            m_base.push_back(p);
+            for (int64_t m = int64_t{p} * p; m <= root; m += 2 * p) {
+                composite[m] = true;
+            }
+        }
+        for (int p : m_base) {
+            if (p >= SMALL_PRIME_END) {
+                break;
+            }
+            std::vector<uint64_t> words(p, ~uint64_t{0});
+            for (int64_t j = 0; j < 64 * p; ++j) {
+                if ((2 * j + 1) % p == 0) {
+                    words[j / 64] &= ~(uint64_t{1} << (j % 64));
+                }
+            }
+            m_patterns.push_back(std::move(words));
+        }
+        for (size_t i = 0; i < m_slots.size(); ++i) {
+            m_slots[i].m_ticket.store(2 * i, std::memory_order_relaxed);
+        }
+        for (unsigned i = 0; i < threads; ++i) {
+            m_workers.emplace_back([this] { work(); });
+        }
+    }
+
+    ~SegmentedSieve() {
+        m_stop.store(true);
+        for (Slot & slot : m_slots) {
+            slot.m_ticket.store(-1);
+            slot.m_ticket.notify_all();
+        }
+        for (std::thread & worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    int64_t segments() const { return m_segments; }
+
+    // Primes of segment index in increasing order, blocks until it is sieved.
+    // The span stays valid until release(index).
+    std::span<const int> acquire(int64_t index) {
+        Slot & slot = m_slots[index % m_slots.size()];
+        wait_ticket(slot, 2 * index + 1);
+        return slot.m_primes;
+    }
+
+    // Hands the slot of segment index over to the segment one ring further.
+    void release(int64_t index) {
+        Slot & slot = m_slots[index % m_slots.size()];
+        slot.m_ticket.store(2 * (index + m_slots.size()), std::memory_order_release);
+        slot.m_ticket.notify_all();
+    }
+
+private:
+    // Base primes below this clear at least one bit of every word, so they are
+    // applied as masks: word w of the odd numbers only depends on w % p.
+    static constexpr int SMALL_PRIME_END = 64;
+
+    struct alignas(64) Slot {
+        std::atomic<int64_t> m_ticket;
+        std::vector<int> m_primes;
+    };
+
+    // False once the sieve is being destroyed.
+    bool wait_ticket(Slot & slot, int64_t ticket) {
+        for (int64_t seen = slot.m_ticket.load(std::memory_order_acquire); seen != ticket;
+             seen = slot.m_ticket.load(std::memory_order_acquire)) {
+            if (m_stop.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            slot.m_ticket.wait(seen, std::memory_order_acquire);
+        }
+        return true;
+    }
+
+    void work() {
+        std::vector<uint64_t> bits(SEGMENT_BITS / 64);
+        for (int64_t index = m_next.fetch_add(1); index < m_segments; index = m_next.fetch_add(1)) {
+            Slot & slot = m_slots[index % m_slots.size()];
+            if (!wait_ticket(slot, 2 * index)) {
+                return;
+            }
+            sieve(index, bits, slot.m_primes);
+            slot.m_ticket.store(2 * index + 1, std::memory_order_release);
+            slot.m_ticket.notify_all();
+        }
+    }
+
+    // Bit j of the segment stands for low + 2 * j + 1.
+    void sieve(int64_t index, std::vector<uint64_t> & bits, std::vector<int> & primes) const {
+        const int64_t low = index * SEGMENT_SPAN;
+        const int64_t high = std::min<int64_t>(low + SEGMENT_SPAN, m_end);
+        const int64_t count = (high - low) / 2;
+        std::ranges::fill(bits, ~uint64_t{0});
+        for (const std::vector<uint64_t> & pattern : m_patterns) {
+            size_t k = index * (SEGMENT_BITS / 64) % pattern.size();
+            for (uint64_t & word : bits) {
+                word &= pattern[k];
+                k = (k + 1 == pattern.size()) ? 0 : k + 1;
+            }
+        }
+        for (int p : m_base | std::views::drop(m_patterns.size())) {
+            int64_t first = int64_t{p} * p;
+            if (first >= high) {
+                break;
+            }
+            if (first < low) {
+                first = (low + p - 1) / p * p;
+                first += (first % 2 == 0) ? p : 0;
+            }
+            for (uint64_t j = (first - low) / 2; j < static_cast<uint64_t>(count); j += p) {
+                bits[j / 64] &= ~(uint64_t{1} << (j % 64));
+            }
+        }
+        if (index == 0) {
+            // The masks struck the small primes themselves, and 1 is no prime.
+            for (int p : m_base | std::views::take(m_patterns.size())) {
+                bits[0] |= uint64_t{1} << (p / 2);
+            }
+            bits[0] &= ~uint64_t{1};
+        }
+        primes.clear();
+        for (int64_t w = 0; w * 64 < count; ++w) {
+            uint64_t word = bits[w];
+            if (count - w * 64 < 64) {
+                word &= (uint64_t{1} << (count - w * 64)) - 1;
+            }
+            for (; word; word &= word - 1) {
+                primes.push_back(static_cast<int>(low + 2 * (w * 64 + std::countr_zero(word)) + 1));
+            }
+        }
+    }
+
+    const int m_end;
+    const int64_t m_segments;
+    std::vector<int> m_base;
+    std::vector<std::vector<uint64_t>> m_patterns;
+    std::vector<Slot> m_slots;
+    std::atomic<int64_t> m_next{0};
+    std::atomic<bool> m_stop{false};
+    std::vector<std::thread> m_workers;
+};
+
+// The primes below end in order, as the filter chain over source(end) yields
+// them. The workers start on the first resume after 2 and stop with the generator.
+Generator segmented_primes(int end, unsigned threads = std::max(1u, std::thread::hardware_concurrency())) {
+    if (end <= 2) {
+        co_return;
+    }
+    co_yield 2;
+    SegmentedSieve sieve(end, threads);
+    for (int64_t i = 0; i < sieve.segments(); ++i) {
+        for (int prime : sieve.acquire(i)) {
+            co_yield prime;
+        }
+        sieve.release(i);
+    }
+}
+
+// Quiet filter chain against the segmented sieve below chain_end, then the
+// segmented sieve alone below end on one thread and on every hardware thread.
+void bench_segmented(int chain_end, int end) {
+    auto start = std::chrono::steady_clock::now();
+    int chain_primes = 0;
+    {
+        Generator g = source(chain_end);
+        while (std::optional<int> optional_prime = g.next()) {
+            ++chain_primes;
+            g = filter_quiet(std::move(g), optional_prime.value());
+        }
+    }
+    double chain_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    int segmented_count = 0;
+    Generator g = segmented_primes(chain_end, 1);
+    while (g.next()) {
+        ++segmented_count;
+    }
+    double segmented_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "sieve " << chain_end << " filter chain " << chain_primes << " primes " << chain_ms << " ms, segmented "
+              << segmented_count << " primes " << segmented_ms << " ms\n";
+
+    for (unsigned threads : {1u, std::max(1u, std::thread::hardware_concurrency())}) {
+        start = std::chrono::steady_clock::now();
+        long primes = 0;
+        long checksum = 0;
+        Generator g = segmented_primes(end, threads);
+        while (std::optional<int> prime = g.next()) {
+            ++primes;
+            checksum += prime.value();
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "segmented sieve " << end << " threads " << threads << ": " << primes << " primes " << secs << " s, "
+                  << primes / secs << " primes/s (sum " << checksum << ")\n";
+    }
+}
+
+// Frames and system allocations per coroutine for the sieve up to end, plus
+// create/destroy latency of a single generator.
+void bench_frames(int end, long creations) {
+    std::streambuf * cout_buf = std::cout.rdbuf(nullptr);
+    FrameStats before = FramePool::stats();
+    auto start = std::chrono::steady_clock::now();
+    int primes = 0;
+    {
+        Generator g = source(end);
+        while (std::optional<int> optional_prime = g.next()) {
+            ++primes;
+            g = filter(std::move(g), optional_prime.value());
+        }
+    }
+    double sieve_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    FrameStats after = FramePool::stats();
+
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < creations; ++i) {
+        Generator g = source(0);
+    }
+    double create_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / creations;
+    std::cout.rdbuf(cout_buf);
+
+    uint64_t frames = after.frames - before.frames;
+    std::cout << (FramePool::enabled() ? "pooled " : "system ")
+              << "sieve " << end << " primes " << primes
+              << " coroutines " << frames
+              << " allocations/coroutine " << static_cast<double>(after.system_allocations - before.system_allocations) / frames
+              << " sieve " << sieve_ms << " ms"
+              << " create+destroy " << create_ns << " ns\n";
+}
+
+// Per-element cost of each generator flavour, and of the quiet scalar sieve against the segmented one.
+void suite() {
+    static constexpr int ELEMENTS = 1000000;
+    BenchSuite bench{"fizzbuzz"};
+    bench.run("generator_next", ELEMENTS, [] {
+        Generator g = source(ELEMENTS + 2);
+        long sum = 0;
+        while (std::optional<int> x = g.next()) {
+            sum += x.value();
+        }
+        bench_keep(sum);
+    });
+    bench.run("recursive_generator_depth10_next", ELEMENTS, [] {
+        RecursiveGenerator g = counter(ELEMENTS);
+        for (int i = 0; i < 10; ++i) {
+            g = delegate(std::move(g));
+        }
+        long sum = 0;
+        while (std::optional<int> x = g.next()) {
+            sum += x.value();
+        }
+        bench_keep(sum);
+    });
+    bench.run("batch_generator_element", ELEMENTS, [] {
+        long sum = 0;
+        for (int x : source_batched(ELEMENTS + 2)) {
+            sum += x;
+        }
+        bench_keep(sum);
+    });
+    static constexpr int SIEVE_END = 20000;
+    bench.run("sieve_20000", 1, [] {
+        int primes = 0;
+        Generator g = source(SIEVE_END);
+        while (std::optional<int> optional_prime = g.next()) {
+            ++primes;
+            g = filter_quiet(std::move(g), optional_prime.value());
+        }
+        bench_keep(primes);
+    });
+    bench.run("segmented_sieve_20000", 1, [] {
+        int primes = 0;
+        Generator g = segmented_primes(SIEVE_END);
+        while (g.next()) {
+            ++primes;
+        }
+        bench_keep(primes);
+    });
+    // 5761455 primes below 10^8, per prime.
+    bench.run("segmented_sieve_100000000_prime", 5761455, [] {
+        long sum = 0;
+        Generator g = segmented_primes(100000000);
+        while (std::optional<int> x = g.next()) {
+            sum += x.value();
+        }
+        bench_keep(sum);
+    });
+}
+
+int main(int argc, char ** argv) {
+    if (argc > 1 && std::string_view{argv[1]} == "suite") {
+        suite();
+        return 0;
+    }
+    if (argc > 1 && std::string_view{argv[1]} == "bench") {
+        FramePool::set_enabled(false);
+        bench_frames(5000, 1000000);
+        FramePool::set_enabled(true);
+        bench_frames(5000, 1000000);
+        for (int depth : {1, 10, 100, 1229}) {
+            bench_nesting(depth, 10000);
+        }
+        bench_sieve(10000);
+        bench_batched(1000000);
+        bench_segmented(100000, 1000000000);
+        return 0;
+    }
+
     Generator g = source(20);
     while (std::optional<int> optional_prime = g.next()) {
         int prime = optional_prime.value();
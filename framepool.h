@@ -0,0 +1,287 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Size-class allocator for coroutine frames. Promise types opt in by deriving
+// from PooledPromise, which routes the frame through frame_allocate() and
+// frame_deallocate(). Frames up to MAX_POOLED_FRAME bytes come from per-thread
+// free lists that spill into and refill from a shared pool in batches, larger
+// frames go straight to global operator new. While a FrameArena::Scope is
+// active on a thread, new frames come from that arena instead.
+
+static constexpr size_t FRAME_HEADER = alignof(std::max_align_t);
+static constexpr size_t MIN_FRAME_CLASS = 64;
+static constexpr size_t NUM_FRAME_CLASSES = 8;
+static constexpr size_t MAX_POOLED_FRAME = MIN_FRAME_CLASS << (NUM_FRAME_CLASSES - 1);
+static constexpr size_t FRAME_BATCH = 32;
+static constexpr size_t MAX_CACHED_FRAMES = 4 * FRAME_BATCH;
+
+class FrameArena;
+
+enum class FrameOrigin : uint32_t { SYSTEM, POOL, ARENA };
+
+// Prepended to every frame so deallocation does not depend on who is active at free time.
+struct alignas(FRAME_HEADER) FrameHeader {
+    FrameArena * m_arena;
+    uint32_t m_size_class;
+    FrameOrigin m_origin;
+};
+static_assert(sizeof(FrameHeader) == FRAME_HEADER);
+
+struct FreeFrame {
+    FreeFrame * m_next;
+};
+
+inline size_t frame_class_size(uint32_t size_class) { return MIN_FRAME_CLASS << size_class; }
+
+// Returns NUM_FRAME_CLASSES when the frame is too large to be pooled.
+inline uint32_t frame_size_class(size_t total) {
+    if (total > MAX_POOLED_FRAME) {
+        return NUM_FRAME_CLASSES;
+    }
+    return (total <= MIN_FRAME_CLASS) ? 0 : std::bit_width((total - 1) / MIN_FRAME_CLASS);
+}
+
+struct FrameStats {
+    uint64_t frames;
+    uint64_t system_allocations;
+};
+
+class FramePool {
+public:
+    static FramePool & instance() {
+        // Never destroyed, thread caches flush into it from thread_local destructors.
+        static FramePool * pool = new FramePool{};
+        return *pool;
+    }
+
+    // Benchmarking switch, when disabled every frame goes to global operator new.
+    static void set_enabled(bool enabled) { s_enabled.store(enabled, std::memory_order_relaxed); }
+    static bool enabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+    // Adds up the counts of all threads, the exited ones included.
+    static FrameStats stats() {
+        FramePool & pool = instance();
+        std::lock_guard lock{pool.m_mutex};
+        FrameStats sum = pool.m_retired;
+        for (const ThreadCache * cache : pool.m_caches) {
+            cache->add_to(sum);
+        }
+        return sum;
+    }
+    // Counted per thread, so allocating a frame touches no shared cache line.
+    static void count_frame() { bump(thread_cache().m_frames); }
+    static void count_system_allocation() { bump(thread_cache().m_system_allocations); }
+
+    static void * allocate(uint32_t size_class) {
+        ThreadCache & cache = thread_cache();
+        if (!cache.m_heads[size_class]) {
+            instance().refill(cache, size_class);
+        }
+        FreeFrame * frame = cache.m_heads[size_class];
+        cache.m_heads[size_class] = frame->m_next;
+        --cache.m_counts[size_class];
+        return frame;
+    }
+
+    static void deallocate(void * ptr, uint32_t size_class) {
+        ThreadCache & cache = thread_cache();
+        FreeFrame * frame = static_cast<FreeFrame*>(ptr);
+        frame->m_next = cache.m_heads[size_class];
+        cache.m_heads[size_class] = frame;
+        if (++cache.m_counts[size_class] > MAX_CACHED_FRAMES) {
+            instance().spill(cache, size_class, FRAME_BATCH);
+        }
+    }
+
+private:
+    struct ThreadCache {
+        FreeFrame * m_heads[NUM_FRAME_CLASSES] = {};
+        size_t m_counts[NUM_FRAME_CLASSES] = {};
+        // Written by the owning thread only, read by stats().
+        std::atomic<uint64_t> m_frames{0};
+        std::atomic<uint64_t> m_system_allocations{0};
+
+        ThreadCache() {
+            FramePool & pool = instance();
+            std::lock_guard lock{pool.m_mutex};
+            pool.m_caches.push_back(this);
+        }
+
+        ~ThreadCache() {
+            for (uint32_t c = 0; c < NUM_FRAME_CLASSES; ++c) {
+                instance().spill(*this, c, m_counts[c]);
+            }
+            FramePool & pool = instance();
+            std::lock_guard lock{pool.m_mutex};
+            add_to(pool.m_retired);
+            std::erase(pool.m_caches, this);
+        }
+
+        void add_to(FrameStats & sum) const {
+            sum.frames += m_frames.load(std::memory_order_relaxed);
+            sum.system_allocations += m_system_allocations.load(std::memory_order_relaxed);
+        }
+    };
+
+    // Single writer, a plain load and store instead of a locked add.
+    static void bump(std::atomic<uint64_t> & counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static ThreadCache & thread_cache() {
+        static thread_local ThreadCache cache;
+        return cache;
+    }
+
+    void refill(ThreadCache & cache, uint32_t size_class) {
+        {
+            std::lock_guard lock{m_mutex};
+            for (size_t i = 0; i < FRAME_BATCH && m_heads[size_class]; ++i) {
+                FreeFrame * frame = m_heads[size_class];
+                m_heads[size_class] = frame->m_next;
+                frame->m_next = cache.m_heads[size_class];
+                cache.m_heads[size_class] = frame;
+                ++cache.m_counts[size_class];
+            }
+        }
+        if (cache.m_heads[size_class]) {
+            return;
+        }
+
+        // Carve a fresh slab, slabs live for the whole process.
+        const size_t size = frame_class_size(size_class);
+        char * slab = static_cast<char*>(::operator new(size * FRAME_BATCH));
+        count_system_allocation();
+        for (size_t i = 0; i < FRAME_BATCH; ++i) {
+            FreeFrame * frame = reinterpret_cast<FreeFrame*>(slab + i * size);
+            frame->m_next = cache.m_heads[size_class];
+            cache.m_heads[size_class] = frame;
+        }
+        cache.m_counts[size_class] += FRAME_BATCH;
+    }
+
+    void spill(ThreadCache & cache, uint32_t size_class, size_t count) {
+        std::lock_guard lock{m_mutex};
+        for (size_t i = 0; i < count && cache.m_heads[size_class]; ++i) {
+            FreeFrame * frame = cache.m_heads[size_class];
+            cache.m_heads[size_class] = frame->m_next;
+            --cache.m_counts[size_class];
+            frame->m_next = m_heads[size_class];
+            m_heads[size_class] = frame;
+        }
+    }
+
+    // Guards the shared free lists and the stats registry.
+    std::mutex m_mutex;
+    FreeFrame * m_heads[NUM_FRAME_CLASSES] = {};
+    std::vector<ThreadCache*> m_caches;
+    // Counts of the threads that have exited.
+    FrameStats m_retired{};
+
+    static inline std::atomic<bool> s_enabled{true};
+};
+
+// Single-threaded arena, typically owned by a scheduler. Frames allocated from
+// it may only be freed on the owning thread and must not outlive it.
+class FrameArena {
+public:
+    FrameArena() = default;
+    FrameArena(const FrameArena &) = delete;
+    FrameArena& operator=(const FrameArena &) = delete;
+
+    ~FrameArena() {
+        for (void * chunk : m_chunks) {
+            ::operator delete(chunk);
+        }
+    }
+
+    void * allocate(uint32_t size_class) {
+        if (!m_heads[size_class]) {
+            const size_t size = frame_class_size(size_class);
+            char * chunk = static_cast<char*>(::operator new(size * FRAME_BATCH));
+            FramePool::count_system_allocation();
+            m_chunks.push_back(chunk);
+            for (size_t i = 0; i < FRAME_BATCH; ++i) {
+                FreeFrame * frame = reinterpret_cast<FreeFrame*>(chunk + i * size);
+                frame->m_next = m_heads[size_class];
+                m_heads[size_class] = frame;
+            }
+        }
+        FreeFrame * frame = m_heads[size_class];
+        m_heads[size_class] = frame->m_next;
+        return frame;
+    }
+
+    void deallocate(void * ptr, uint32_t size_class) {
+        FreeFrame * frame = static_cast<FreeFrame*>(ptr);
+        frame->m_next = m_heads[size_class];
+        m_heads[size_class] = frame;
+    }
+
+    // Routes frames created on this thread to the arena until the scope ends.
+    class Scope {
+    public:
+        explicit Scope(FrameArena & arena) : m_previous{s_current} { s_current = &arena; }
+        ~Scope() { s_current = m_previous; }
+        Scope(const Scope &) = delete;
+        Scope& operator=(const Scope &) = delete;
+    private:
+        FrameArena * m_previous;
+    };
+
+    static FrameArena * current() { return s_current; }
+
+private:
+    FreeFrame * m_heads[NUM_FRAME_CLASSES] = {};
+    std::vector<void*> m_chunks;
+
+    static inline thread_local FrameArena * s_current = nullptr;
+};
+
+inline void * frame_allocate(size_t size) {
+    FramePool::count_frame();
+    const size_t total = size + FRAME_HEADER;
+    const uint32_t size_class = frame_size_class(total);
+    FrameArena * arena = FrameArena::current();
+    FrameHeader * header;
+    if (size_class == NUM_FRAME_CLASSES || (!arena && !FramePool::enabled())) {
+        header = static_cast<FrameHeader*>(::operator new(total));
+        FramePool::count_system_allocation();
+        *header = {nullptr, size_class, FrameOrigin::SYSTEM};
+    } else if (arena) {
+        header = static_cast<FrameHeader*>(arena->allocate(size_class));
+        *header = {arena, size_class, FrameOrigin::ARENA};
+    } else {
+        header = static_cast<FrameHeader*>(FramePool::allocate(size_class));
+        *header = {nullptr, size_class, FrameOrigin::POOL};
+    }
+    return header + 1;
+}
+
+inline void frame_deallocate(void * ptr, size_t) noexcept {
+    FrameHeader * header = static_cast<FrameHeader*>(ptr) - 1;
+    switch (header->m_origin) {
+    case FrameOrigin::SYSTEM:
+        ::operator delete(header);
+        break;
+    case FrameOrigin::POOL:
+        FramePool::deallocate(header, header->m_size_class);
+        break;
+    case FrameOrigin::ARENA:
+        header->m_arena->deallocate(header, header->m_size_class);
+        break;
+    }
+}
+
+// Base for promise types that want pooled frames.
+struct PooledPromise {
+    static void * operator new(size_t size) { return frame_allocate(size); }
+    static void operator delete(void * ptr, size_t size) noexcept { frame_deallocate(ptr, size); }
+};
@@ -1,15 +1,22 @@
+#include <algorithm>
+#include <chrono>
+#include <concepts>
 #include <coroutine>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <print>
 #include <utility>
 #include <vector>
 
+#include "bench.h"
+#include "framepool.h"
+
 using namespace std::string_literals;
 
 struct Generator {
 
-    struct promise_type {
+    struct promise_type : PooledPromise {
         int value{};
 
         void unhandled_exception() noexcept {}
@@ -19,6 +26,7 @@ struct Generator {
             value = std::move(msg);
             return {};
         }
+        void return_void() noexcept {}
         std::suspend_always final_suspend() noexcept { return {}; }
     };
 
@@ -26,37 +34,110 @@ struct Generator {
     handle corohdl{};
     explicit Generator(promise_type* p ) : corohdl{handle::from_promise(*p)} {}
     Generator(Generator && rhs) : corohdl{std::exchange(rhs.corohdl, nullptr)} {}
+    Generator & operator=(Generator && rhs) {
+        if (this != &rhs) {
+            if (corohdl) corohdl.destroy();
+            corohdl = std::exchange(rhs.corohdl, nullptr);
+        }
+        return *this;
+    }
     ~Generator() { if (corohdl) corohdl.destroy(); }
     bool is_done() const { return corohdl.done(); }
     auto value() const { return std::move(corohdl.promise().value); }
     void resume() { if(!corohdl.done()) corohdl.resume(); }
 };
-    
-template<typename T>
-Generator interleave(T a, T b) {
-    auto l = [](T & v) -> Generator {
-        for (const auto & x : v) co_yield x;
-    };
 
-    auto agen = l(a);
-    auto bgen = l(b);
+// Yields the elements of c, which has to outlive the generator.
+template <typename C>
+Generator elements(const C & c) {
+    for (const auto & x : c) co_yield x;
+}
 
-    while (!agen.is_done() || !bgen.is_done()) {
-        
-        if (!agen.is_done()) {
-            co_yield agen.value();
-            agen.resume();
+// Round-robin over any number of generators, exhausted ones drop out and the
+// rest keep their order.
+Generator interleave(std::vector<Generator> gens) {
+    while (!gens.empty()) {
+        for (auto & g : gens) {
+            if (g.is_done()) continue;
+            co_yield g.value();
+            g.resume();
         }
+        std::erase_if(gens, [](const Generator & g) { return g.is_done(); });
+    }
+}
+
+template <std::same_as<Generator>... Gs>
+Generator interleave(Generator first, Gs... rest) {
+    std::vector<Generator> gens;
+    gens.reserve(1 + sizeof...(rest));
+    gens.push_back(std::move(first));
+    (gens.push_back(std::move(rest)), ...);
+    return interleave(std::move(gens));
+}
 
-        if (!bgen.is_done()) {
-            co_yield bgen.value();
-            bgen.resume();
+// Three frames per interleave() call: the outer generator and one per container.
+void bench_frames(long iterations)
+{
+    std::vector<int> left{1, 2, 3, 4};
+    std::vector<int> right{5, 6, 7, 8};
+    FrameStats before = FramePool::stats();
+    long sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; ++i) {
+        Generator g{interleave(elements(left), elements(right))};
+        while (!g.is_done()) {
+            sum += g.value();
+            g.resume();
         }
     }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+    FrameStats after = FramePool::stats();
+    uint64_t frames = after.frames - before.frames;
+    std::println("{} coroutines {} allocations/coroutine {} {} ns/interleave (sum {})",
+        FramePool::enabled() ? "pooled" : "system", frames,
+        static_cast<double>(after.system_allocations - before.system_allocations) / frames, ns, sum);
 }
 
-int main()
+// Element throughput through interleave(), each element costs a resume of the
+// outer generator and of one of the inner ones.
+void suite()
 {
+    static constexpr long ELEMENTS = 1000000;
+    BenchSuite bench{"interleaving"};
+    std::vector<int> left(ELEMENTS / 2, 1);
+    std::vector<int> right(ELEMENTS / 2, 2);
+    bench.run("generator_element", ELEMENTS, [&] {
+        Generator g{interleave(elements(left), elements(right))};
+        long sum = 0;
+        while (!g.is_done()) {
+            sum += g.value();
+            g.resume();
+        }
+        bench_keep(sum);
+    });
+    bench.run("interleave_create_destroy", ELEMENTS / 10, [&] {
+        std::vector<int> one{1};
+        for (long i = 0; i < ELEMENTS / 10; ++i) {
+            Generator g{interleave(elements(one), elements(one))};
+            bench_keep(g.corohdl);
+        }
+    });
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc > 1 && std::string_view{argv[1]} == "suite") {
+        suite();
+        return 0;
+    }
+    if (argc > 1 && std::string_view{argv[1]} == "bench") {
+        FramePool::set_enabled(false);
+        bench_frames(1000000);
+        FramePool::set_enabled(true);
+        bench_frames(1000000);
+        return 0;
+    }
+
     using IntVector = std::vector<int>;
     IntVector mainv{1,2,3,4,5,6,7,8};
     auto middle_iter{mainv.begin()};
@@ -64,7 +145,7 @@ int main()
     IntVector left_half(mainv.begin(), middle_iter);
     IntVector right_half(middle_iter, mainv.end());
 
-    Generator g{interleave(left_half, right_half)};
+    Generator g{interleave(elements(left_half), elements(right_half))};
     while (!g.is_done()) {
         std::cout << g.value() << "\n";
         g.resume();
@@ -1,55 +1,777 @@
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/io_uring.h>
 #include <poll.h>
-#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cassert>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <concepts>
 #include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <exception>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "bench.h"
+#include "framepool.h"
+#include "taskstats.h"
+
+// Build with -DPIPES_TRACE to log every await_ready, await_suspend and
+// await_resume, and with -DPIPES_STATS to collect per-fd counters and
+// suspend-to-resume latency histograms. Both compile to nothing otherwise.
+#ifdef PIPES_TRACE
+#define TRACE(...) (std::cout << __VA_ARGS__ << '\n')
+#else
+#define TRACE(...) do {} while (0)
+#endif
+
+#ifdef PIPES_STATS
+static constexpr bool STATS = true;
+#else
+static constexpr bool STATS = false;
+#endif
 
 enum class IOp { READ, WRITE };
 
-static constexpr int MAX_EXCLUSIVE_FD = 32;
+enum class Backend { EPOLL, IO_URING };
+
+static constexpr int MAX_EPOLL_EVENTS = 256;
+static constexpr unsigned IO_URING_ENTRIES = 256;
+// user_data of io_uring requests that do not belong to an Awaitable.
+static constexpr __u64 CANCEL_USER_DATA = 0;
+static constexpr __u64 TIMEOUT_USER_DATA = 1;
+
+static constexpr size_t STREAM_BUFFER_SIZE = 4096;
+static constexpr int MAX_WRITEV_IOVECS = 64;
+static constexpr size_t LINE_BUFFER_SIZE = 65536;
+
+static constexpr unsigned TIMER_LEVELS = 4;
+static constexpr unsigned TIMER_SLOT_BITS = 8;
+static constexpr unsigned TIMER_SLOTS = 1u << TIMER_SLOT_BITS;
 
 using AsyncIOResult = std::pair<ssize_t, int>;
 
+// Log-linear histogram in the spirit of HdrHistogram: values below
+// 2^SUB_BITS are exact, every power of two above is split into
+// 2^SUB_BITS buckets, so the relative error stays under 1/16.
+class LatencyHistogram {
+public:
+    static constexpr unsigned SUB_BITS = 4;
+    static constexpr uint64_t SUB_BUCKETS = uint64_t{1} << SUB_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    void record(uint64_t value) {
+        ++m_counts[index(value)];
+        ++m_count;
+        m_max = std::max(m_max, value);
+    }
+
+    void merge(const LatencyHistogram & other) {
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            m_counts[i] += other.m_counts[i];
+        }
+        m_count += other.m_count;
+        m_max = std::max(m_max, other.m_max);
+    }
+
+    uint64_t count() const { return m_count; }
+    uint64_t max() const { return m_max; }
+
+    // Upper bound of the bucket holding the q-th quantile, 0 when empty.
+    uint64_t percentile(double q) const {
+        const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * m_count + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += m_counts[i];
+            if (seen >= rank) {
+                return std::min(upper_bound(i), m_max);
+            }
+        }
+        return 0;
+    }
+
+private:
+    static size_t index(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return value;
+        }
+        const unsigned msb = std::bit_width(value) - 1;
+        const unsigned group = msb - SUB_BITS + 1;
+        return group * SUB_BUCKETS + ((value >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1));
+    }
+
+    static uint64_t upper_bound(size_t index) {
+        const size_t group = index / SUB_BUCKETS;
+        if (group == 0) {
+            return index;
+        }
+        const uint64_t lower = (SUB_BUCKETS + index % SUB_BUCKETS) << (group - 1);
+        return lower + (uint64_t{1} << (group - 1)) - 1;
+    }
+
+    std::array<uint64_t, BUCKETS> m_counts{};
+    uint64_t m_count = 0;
+    uint64_t m_max = 0;
+};
+
+struct FdStats {
+    uint64_t ops = 0;
+    uint64_t eagain = 0;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+};
+
+// Point-in-time copy of the Scheduler counters, cheap enough to take and export periodically.
+struct SchedulerStats {
+    long syscalls = 0;
+    long ops = 0;
+    size_t timers = 0;
+    // Only fds with any activity since their last forget_fd(), in fd order.
+    std::vector<std::pair<int, FdStats>> fds;
+    // Nanoseconds from await_suspend to await_resume of operations that had to park.
+    LatencyHistogram read_latency;
+    LatencyHistogram write_latency;
+};
+
+std::ostream & operator<<(std::ostream & os, const LatencyHistogram & h) {
+    return os << "n " << h.count() << " p50 " << h.percentile(0.5) << " p99 " << h.percentile(0.99)
+              << " p99.9 " << h.percentile(0.999) << " max " << h.max() << " ns";
+}
+
+std::ostream & operator<<(std::ostream & os, const SchedulerStats & stats) {
+    os << "syscalls " << stats.syscalls << " ops " << stats.ops << " timers " << stats.timers << "\n";
+    for (const auto & [fd, fd_stats] : stats.fds) {
+        os << "fd " << fd << " ops " << fd_stats.ops << " eagain " << fd_stats.eagain
+           << " read " << fd_stats.bytes_read << " written " << fd_stats.bytes_written << "\n";
+    }
+    return os << "read latency  " << stats.read_latency << "\nwrite latency " << stats.write_latency << "\n";
+}
+
 class Awaitable;
+class CancellationToken;
+class SleepAwaitable;
+class YieldAwaitable;
+class AsyncWriter;
+
+// Minimal io_uring wrapper over the raw syscalls, no liburing dependency.
+class IoUring {
+public:
+    IoUring() = default;
+    ~IoUring();
+    IoUring(const IoUring &) = delete;
+    IoUring& operator=(const IoUring &) = delete;
+
+    bool init(unsigned entries);
+    bool enabled() const { return m_fd >= 0; }
+
+    // Returns nullptr when the submission ring is full, the caller has to enter() first.
+    io_uring_sqe * get_sqe();
+    unsigned pending() const { return m_sq_pending; }
+    // Submits everything queued by get_sqe() and waits for at least wait_nr completions.
+    int enter(unsigned wait_nr);
+
+    template <typename F>
+    unsigned for_each_cqe(F && f) {
+        unsigned head = *m_cq_head;
+        unsigned tail = std::atomic_ref<unsigned>(*m_cq_tail).load(std::memory_order_acquire);
+        unsigned n = 0;
+        for (; head != tail; ++head, ++n) {
+            f(m_cqes[head & *m_cq_mask]);
+        }
+        std::atomic_ref<unsigned>(*m_cq_head).store(head, std::memory_order_release);
+        return n;
+    }
+
+private:
+    // Unmaps the rings and closes the fd, after which enabled() is false.
+    void reset();
+
+    int m_fd = -1;
+    void * m_sq_ptr = MAP_FAILED;
+    size_t m_sq_size = 0;
+    void * m_cq_ptr = MAP_FAILED;
+    size_t m_cq_size = 0;
+    io_uring_sqe * m_sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t m_sqes_size = 0;
+
+    unsigned * m_sq_head = nullptr;
+    unsigned * m_sq_tail = nullptr;
+    unsigned * m_sq_mask = nullptr;
+    unsigned * m_sq_array = nullptr;
+    unsigned m_sq_entries = 0;
+    unsigned m_sq_pending = 0;
+
+    unsigned * m_cq_head = nullptr;
+    unsigned * m_cq_tail = nullptr;
+    unsigned * m_cq_mask = nullptr;
+    io_uring_cqe * m_cqes = nullptr;
+};
+
+bool IoUring::init(unsigned entries) {
+    io_uring_params params{};
+    m_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (m_fd < 0) {
+        return false;
+    }
+
+    m_sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+    }
+    m_sq_ptr = mmap(nullptr, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sq_ptr == MAP_FAILED) {
+        reset();
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        m_cq_ptr = m_sq_ptr;
+    } else {
+        m_cq_ptr = mmap(nullptr, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cq_ptr == MAP_FAILED) {
+            reset();
+            return false;
+        }
+    }
+    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = static_cast<io_uring_sqe*>(mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES));
+    if (m_sqes == MAP_FAILED) {
+        reset();
+        return false;
+    }
+
+    char * sq = static_cast<char*>(m_sq_ptr);
+    m_sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    m_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    m_sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    m_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    m_sq_entries = params.sq_entries;
+
+    char * cq = static_cast<char*>(m_cq_ptr);
+    m_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    m_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    m_cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+}
+
+IoUring::~IoUring() {
+    reset();
+}
+
+void IoUring::reset() {
+    if (m_sqes != MAP_FAILED) {
+        munmap(m_sqes, m_sqes_size);
+        m_sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    }
+    if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr) {
+        munmap(m_cq_ptr, m_cq_size);
+    }
+    m_cq_ptr = MAP_FAILED;
+    if (m_sq_ptr != MAP_FAILED) {
+        munmap(m_sq_ptr, m_sq_size);
+        m_sq_ptr = MAP_FAILED;
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+io_uring_sqe * IoUring::get_sqe() {
+    unsigned head = std::atomic_ref<unsigned>(*m_sq_head).load(std::memory_order_acquire);
+    unsigned tail = *m_sq_tail + m_sq_pending;
+    if (tail - head >= m_sq_entries) {
+        return nullptr;
+    }
+    unsigned index = tail & *m_sq_mask;
+    m_sq_array[index] = index;
+    ++m_sq_pending;
+    io_uring_sqe * sqe = &m_sqes[index];
+    *sqe = {};
+    return sqe;
+}
+
+int IoUring::enter(unsigned wait_nr) {
+    unsigned to_submit = m_sq_pending;
+    std::atomic_ref<unsigned>(*m_sq_tail).store(*m_sq_tail + to_submit, std::memory_order_release);
+    m_sq_pending = 0;
+    int rc = static_cast<int>(syscall(__NR_io_uring_enter, m_fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+    return (rc < 0) ? -errno : rc;
+}
+
+// Intrusive FIFO of awaitables parked on one direction of one fd.
+struct WaitQueue {
+    Awaitable * head = nullptr;
+    Awaitable * tail = nullptr;
+
+    bool empty() const { return head == nullptr; }
+    void push(Awaitable * awaitable);
+    Awaitable * pop();
+    // Unlinks an awaitable from anywhere in the queue, false when it is not queued.
+    bool remove(Awaitable * awaitable);
+};
+
+// Cancels the async_read/async_write calls it is passed to. cancel() completes
+// the ones still pending with {0, ECANCELED} and operations started afterwards
+// fail the same way without touching their fd. An operation is linked into
+// the token only while it is parked, so passing a token that never fires
+// costs a pointer test. The token must outlive the operations using it.
+class CancellationToken {
+public:
+    CancellationToken() = default;
+    CancellationToken(const CancellationToken &) = delete;
+    CancellationToken& operator=(const CancellationToken &) = delete;
+
+    void cancel();
+    bool cancelled() const { return m_cancelled; }
+    // Makes a cancelled token usable for new operations.
+    void reset() { m_cancelled = false; }
+
+    void add(Awaitable * awaitable);
+    void remove(Awaitable * awaitable);
+
+private:
+    Awaitable * m_head = nullptr;
+    bool m_cancelled = false;
+};
+
+// Intrusive timer wheel entry, owned by the awaiter that armed it. When it
+// fires it either resumes m_cohandle or, when m_io is set, times that I/O out.
+struct Timer {
+    Timer * m_prev = nullptr;
+    Timer * m_next = nullptr;
+    // Head of the slot list holding the timer, nullptr while not armed.
+    Timer ** m_slot = nullptr;
+    uint64_t m_expiry = 0;
+    std::coroutine_handle<> m_cohandle = nullptr;
+    Awaitable * m_io = nullptr;
+
+    bool armed() const { return m_slot != nullptr; }
+};
+
+// Hierarchical timer wheel with 1 ms ticks: TIMER_LEVELS levels of TIMER_SLOTS
+// doubly linked slots cover 2^32 ms. A timer lives on the level of the highest
+// byte in which its expiry differs from the current tick, so insert and cancel
+// are O(1). Whenever the low byte of the current tick wraps, the matching slot
+// one level up is cascaded down. Timers further out than the wheel covers park
+// in the top level slot visited last and are re-placed when it is cascaded.
+class TimerWheel {
+public:
+    TimerWheel() : m_epoch{std::chrono::steady_clock::now()} {}
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel& operator=(const TimerWheel &) = delete;
+
+    // Ticks elapsed since the wheel was created.
+    uint64_t now() const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_epoch).count();
+    }
+    size_t size() const { return m_count; }
+
+    // Arms the timer to fire no earlier than timeout from now.
+    void add(Timer * timer, std::chrono::steady_clock::duration timeout) {
+        auto expiry = std::chrono::ceil<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_epoch + timeout).count();
+        add_at(timer, static_cast<uint64_t>(std::max<int64_t>(expiry, 0)));
+    }
+    void add_at(Timer * timer, uint64_t expiry) {
+        assert(!timer->armed());
+        timer->m_expiry = std::max(expiry, m_current + 1);
+        place(timer);
+        ++m_count;
+    }
+    void cancel(Timer * timer) {
+        if (timer->armed()) {
+            unlink(timer);
+            --m_count;
+        }
+    }
+
+    // Milliseconds until the wheel next has to advance, -1 when it is empty.
+    // May be early when the nearest timer sits on a higher level, never late.
+    int next_timeout() const;
+
+    // Runs fire(timer) for every timer due up to and including tick target.
+    // Fired timers are disarmed before the callback sees them.
+    template <typename F>
+    void advance(uint64_t target, F && fire) {
+        while (m_current < target) {
+            if (m_count == 0) {
+                m_current = target;
+                return;
+            }
+            ++m_current;
+            for (unsigned level = 1; level < TIMER_LEVELS; ++level) {
+                if (m_current & ((uint64_t{1} << (level * TIMER_SLOT_BITS)) - 1)) {
+                    break;
+                }
+                cascade(level, (m_current >> (level * TIMER_SLOT_BITS)) & (TIMER_SLOTS - 1));
+            }
+            Timer *& head = m_slots[0][m_current & (TIMER_SLOTS - 1)];
+            while (Timer * timer = head) {
+                unlink(timer);
+                --m_count;
+                fire(timer);
+            }
+        }
+    }
+
+private:
+    void place(Timer * timer);
+    void unlink(Timer * timer);
+    void cascade(unsigned level, unsigned slot);
+    // First occupied slot index > from on the level, or TIMER_SLOTS when there is none.
+    unsigned next_occupied(unsigned level, unsigned from) const;
+
+    Timer * m_slots[TIMER_LEVELS][TIMER_SLOTS] = {};
+    uint64_t m_occupied[TIMER_LEVELS][TIMER_SLOTS / 64] = {};
+    uint64_t m_current = 0;
+    size_t m_count = 0;
+    std::chrono::steady_clock::time_point m_epoch;
+};
+
+void TimerWheel::place(Timer * timer) {
+    const uint64_t diff = timer->m_expiry ^ m_current;
+    unsigned level = diff ? (std::bit_width(diff) - 1) / TIMER_SLOT_BITS : 0;
+    unsigned slot;
+    if (level < TIMER_LEVELS) {
+        slot = (timer->m_expiry >> (level * TIMER_SLOT_BITS)) & (TIMER_SLOTS - 1);
+    } else {
+        level = TIMER_LEVELS - 1;
+        slot = ((m_current >> (level * TIMER_SLOT_BITS)) - 1) & (TIMER_SLOTS - 1);
+    }
+    Timer *& head = m_slots[level][slot];
+    timer->m_prev = nullptr;
+    timer->m_next = head;
+    if (head) {
+        head->m_prev = timer;
+    }
+    head = timer;
+    timer->m_slot = &head;
+    m_occupied[level][slot / 64] |= uint64_t{1} << (slot % 64);
+}
+
+void TimerWheel::unlink(Timer * timer) {
+    if (timer->m_next) {
+        timer->m_next->m_prev = timer->m_prev;
+    }
+    if (timer->m_prev) {
+        timer->m_prev->m_next = timer->m_next;
+    } else {
+        *timer->m_slot = timer->m_next;
+        if (!timer->m_next) {
+            const size_t index = timer->m_slot - &m_slots[0][0];
+            m_occupied[index / TIMER_SLOTS][(index % TIMER_SLOTS) / 64] &= ~(uint64_t{1} << (index % 64));
+        }
+    }
+    timer->m_prev = timer->m_next = nullptr;
+    timer->m_slot = nullptr;
+}
+
+void TimerWheel::cascade(unsigned level, unsigned slot) {
+    Timer * timer = m_slots[level][slot];
+    m_slots[level][slot] = nullptr;
+    m_occupied[level][slot / 64] &= ~(uint64_t{1} << (slot % 64));
+    while (timer) {
+        Timer * next = timer->m_next;
+        place(timer);
+        timer = next;
+    }
+}
+
+unsigned TimerWheel::next_occupied(unsigned level, unsigned from) const {
+    for (unsigned slot = from + 1; slot < TIMER_SLOTS; slot = (slot | 63) + 1) {
+        uint64_t bits = m_occupied[level][slot / 64] >> (slot % 64);
+        if (bits) {
+            return slot + std::countr_zero(bits);
+        }
+    }
+    return TIMER_SLOTS;
+}
+
+int TimerWheel::next_timeout() const {
+    if (m_count == 0) {
+        return -1;
+    }
+    // Ticks from m_current to the first slot on any level that holds timers.
+    uint64_t ticks = UINT64_MAX;
+    for (unsigned level = 0; level < TIMER_LEVELS; ++level) {
+        const unsigned shift = level * TIMER_SLOT_BITS;
+        const unsigned current = (m_current >> shift) & (TIMER_SLOTS - 1);
+        const unsigned slot = next_occupied(level, current);
+        if (slot < TIMER_SLOTS) {
+            ticks = std::min(ticks, (uint64_t{slot - current} << shift) - (m_current & ((uint64_t{1} << shift) - 1)));
+        }
+    }
+    if (ticks == UINT64_MAX) {
+        // Only far timers wrapped around on the top level, wake at the next top level cascade.
+        const unsigned shift = (TIMER_LEVELS - 1) * TIMER_SLOT_BITS;
+        ticks = (uint64_t{1} << shift) - (m_current & ((uint64_t{1} << shift) - 1));
+    }
+    const uint64_t due = m_current + ticks;
+    const uint64_t now = this->now();
+    return (due <= now) ? 0 : static_cast<int>(std::min<uint64_t>(due - now, INT_MAX));
+}
+
+// Bytes of stack the coroutines resumed from one TaskTrampoline may nest into.
+static constexpr size_t TASK_STACK_BUDGET = 256 * 1024;
+
+// Keeps symmetric transfer stack-safe when the compiler does not emit it as a
+// tail call, as without optimization, where every transfer nests one more
+// resume(). A trampoline resumes a coroutine from a loop, and a transfer under
+// it that finds more than TASK_STACK_BUDGET bytes used since queues its target
+// and returns to the loop instead, which unwinds the nested resumes. Optimized
+// builds never get there and transfer directly.
+class TaskTrampoline {
+public:
+    // Resumes cohandle and whatever transfers got queued meanwhile.
+    static void resume(std::coroutine_handle<> cohandle) { run(cohandle, nullptr); }
+
+    // For the await_suspend() of stop, which starts cohandle. Transfers to stop
+    // are queued as well, so it is not resumed inside its own await_suspend(),
+    // and the result is what that await_suspend() transfers to.
+    static std::coroutine_handle<> run(std::coroutine_handle<> cohandle, std::coroutine_handle<> stop) {
+        TaskTrampoline trampoline{stop};
+        std::coroutine_handle<> next = std::noop_coroutine();
+        cohandle.resume();
+        for (size_t i = 0; i < trampoline.m_queue.size(); ++i) {
+            const std::coroutine_handle<> queued = trampoline.m_queue[i];
+            if (queued == stop) {
+                next = stop;
+            } else {
+                queued.resume();
+            }
+        }
+        return next;
+    }
+
+    static bool active() { return s_current != nullptr; }
+
+    // For await_suspend() to return, target itself unless the stack is deep.
+    [[gnu::always_inline]] static std::coroutine_handle<> transfer(std::coroutine_handle<> target) {
+        TaskTrampoline * trampoline = s_current;
+        if (trampoline && (target == trampoline->m_stop || trampoline->m_base - static_cast<const char*>(__builtin_frame_address(0)) > static_cast<ptrdiff_t>(TASK_STACK_BUDGET))) [[unlikely]] {
+            trampoline->m_queue.push_back(target);
+            return std::noop_coroutine();
+        }
+        return target;
+    }
+
+private:
+    explicit TaskTrampoline(std::coroutine_handle<> stop)
+        : m_base{static_cast<const char*>(__builtin_frame_address(0))}, m_stop{stop}, m_previous{s_current} {
+        s_current = this;
+    }
+    ~TaskTrampoline() { s_current = m_previous; }
+    TaskTrampoline(const TaskTrampoline &) = delete;
+    TaskTrampoline& operator=(const TaskTrampoline &) = delete;
+
+    const char * m_base;
+    std::coroutine_handle<> m_stop;
+    TaskTrampoline * m_previous;
+    std::vector<std::coroutine_handle<>> m_queue;
 
+    static inline thread_local TaskTrampoline * s_current = nullptr;
+};
+
+// Two backends:
+// EPOLL - readiness reactor. Every fd that ever parks an awaitable is registered
+// once with epoll (EPOLLIN | EPOLLOUT | EPOLLET) and stays registered until
+// forget_fd() or close(). Edge-triggered mode is safe because an Awaitable
+// always attempts the I/O in await_ready() before it parks, so a parked
+// awaitable has observed EAGAIN and the next state change produces an edge.
+// Each fd keeps separate reader and writer queues, so one coroutine can read
+// while others write. An edge retries the waiters of the direction it reports
+// in FIFO order and stops at the first one that still gets EAGAIN.
+// IO_URING - completion backend. Awaitables always suspend and queue an SQE,
+// pump_events() submits the whole batch and reaps completions with a single
+// io_uring_enter. Falls back to EPOLL when io_uring_setup is not available.
+// Both backends share a TimerWheel, the nearest expiry bounds how long
+// pump_events() blocks and due timers are fired before resuming anything.
 class Scheduler {
 public: 
-    Awaitable async_io(int fd, void * ptr, size_t len, IOp iop);
-    Awaitable async_write(int fd, const void * ptr, size_t len);
-    Awaitable async_read(int fd, void * ptr, size_t len);
+    explicit Scheduler(Backend backend = Backend::EPOLL);
+    ~Scheduler();
+    Scheduler(const Scheduler &) = delete;
+    Scheduler& operator=(const Scheduler &) = delete;
+
+    // With iov set the operation is a readv/writev over iovcnt buffers and ptr/len are unused.
+    Awaitable async_io(int fd, void * ptr, size_t len, IOp iop, const iovec * iov = nullptr, int iovcnt = 0, CancellationToken * cancel = nullptr);
+    Awaitable async_write(int fd, const void * ptr, size_t len, CancellationToken * cancel = nullptr);
+    Awaitable async_read(int fd, void * ptr, size_t len, CancellationToken * cancel = nullptr);
+    Awaitable async_writev(int fd, const iovec * iov, int iovcnt);
+    Awaitable async_readv(int fd, const iovec * iov, int iovcnt);
+    SleepAwaitable sleep_for(std::chrono::steady_clock::duration timeout);
+
+    void add_timer(Timer * timer, std::chrono::steady_clock::duration timeout) { m_timers.add(timer, timeout); }
+    void cancel_timer(Timer * timer) { m_timers.cancel(timer); }
+    size_t timers() const { return m_timers.size(); }
+
+    // Resumes the coroutine at the start of the next pump_events(), never from the caller's stack.
+    void post(std::coroutine_handle<> cohandle) { m_posted.push_back(cohandle); }
+    // Suspends the caller until the next pump_events(), after everything the current one woke.
+    YieldAwaitable yield();
+    // Writers with buffered data are flushed at the start of the next pump_events().
+    void mark_dirty(AsyncWriter * writer) { m_dirty.push_back(writer); }
+    void forget_writer(AsyncWriter * writer) { std::erase(m_dirty, writer); }
 
     int pump_events();
-    Awaitable * get_awaitables(int fd) const { return m_awaitables[fd]; }
-    void push_awaitables(int fd, Awaitable * value) { m_awaitables[fd] = value; }
+    // Legacy loop: rebuilds a pollfd set over every slot on each call. Kept for benchmarking.
+    int pump_events_poll();
+
+    bool has_waiters(int fd) const {
+        return static_cast<size_t>(fd) < m_fds.size() && !(m_fds[fd].readers.empty() && m_fds[fd].writers.empty());
+    }
+    void push_awaitables(Awaitable * awaitable);
+    // Completes a parked operation with {0, ECANCELED} from the next pump_events(), see CancellationToken.
+    void cancel_io(Awaitable * awaitable);
+    // Drops the persistent registration, call before closing an fd that may be reused.
+    // Operations still parked on the fd complete with {0, ECANCELED}.
+    void forget_fd(int fd);
+
+    Backend backend() const { return m_uring.enabled() ? Backend::IO_URING : Backend::EPOLL; }
+    void submit_io(Awaitable * awaitable);
+
+    // Number of I/O syscalls issued and I/O operations completed, for benchmarking.
+    long syscalls() const { return m_syscalls; }
+    long ops() const { return m_ops; }
+    void count_syscall() { ++m_syscalls; }
+    void count_op() { ++m_ops; }
+    // Instrumentation hooks, no-ops unless built with PIPES_STATS.
+    void record_eagain(int fd) {
+        if constexpr (STATS) {
+            ++fd_state(fd).stats.eagain;
+        }
+    }
+    void record_op(const Awaitable & awaitable);
+    SchedulerStats snapshot() const;
+    // Introspection of the traced coroutines parked here, see taskstats.h.
+    TaskTable & task_table() { return m_tasks; }
+    const TaskTable & task_table() const { return m_tasks; }
+
 private:
-    Awaitable* m_awaitables[MAX_EXCLUSIVE_FD] = {0};
+    struct FdState {
+        WaitQueue readers;
+        WaitQueue writers;
+        bool registered = false;
+        FdStats stats;
+    };
+
+    FdState & fd_state(int fd) {
+        if (static_cast<size_t>(fd) >= m_fds.size()) {
+            m_fds.resize(fd + 1);
+        }
+        return m_fds[fd];
+    }
+
+    int pump_uring(bool block);
+    void arm_uring_timeout(int timeout);
+    void wake(int fd, bool readable, bool writable);
+    void wake_queue(WaitQueue & queue);
+    // Queues the coroutine of a completed awaitable and disarms its deadline.
+    void finish(Awaitable * awaitable);
+    // Ends a parked operation with {0, err} and disarms its deadline and
+    // cancellation. Returns the coroutine to resume under epoll, under io_uring
+    // the completion of the cancelled request resumes it.
+    std::coroutine_handle<> abort(Awaitable * awaitable, int err);
+    // Deadline expiry: completes a still pending awaitable with ETIMEDOUT.
+    void time_out(Awaitable * awaitable);
+    void expire_timers();
+    // Flushes dirty writers and resumes posted coroutines until neither is left.
+    // Returns true when a coroutine ran, the pump must not block afterwards
+    // because it may have changed whatever the caller's loop is waiting on.
+    bool run_deferred();
+
+    int m_epfd;
+    IoUring m_uring;
+    TimerWheel m_timers;
+    // io_uring only: an IORING_OP_TIMEOUT is in flight and bounds the wait until this tick.
+    bool m_uring_timeout_armed = false;
+    uint64_t m_uring_timeout_due = 0;
+    __kernel_timespec m_uring_timeout{};
+    long m_syscalls = 0;
+    long m_ops = 0;
+    std::vector<FdState> m_fds;
+    std::vector<std::coroutine_handle<>> m_ready;
+    std::vector<std::coroutine_handle<>> m_posted;
+    std::vector<AsyncWriter*> m_dirty;
+    LatencyHistogram m_read_latency;
+    LatencyHistogram m_write_latency;
+    TaskTable m_tasks;
 };
 
 class Awaitable {
 public:
     bool await_ready() {
-        std::cout << "await_ready\n";
+        TRACE("await_ready fd " << m_fd);
+        if (m_cancel && m_cancel->cancelled()) {
+            m_result = std::make_pair(0, ECANCELED);
+            return true;
+        }
+        if (m_scheduler->backend() == Backend::IO_URING) {
+            return false;
+        }
         do { 
+            m_scheduler->count_syscall();
             errno = 0;
-            ssize_t n = (m_iop == IOp::READ) ? read(m_fd, m_ptr, m_len) : write(m_fd, m_ptr, m_len);
+            ssize_t n;
+            if (m_iov) {
+                n = (m_iop == IOp::READ) ? readv(m_fd, m_iov, m_iovcnt) : writev(m_fd, m_iov, m_iovcnt);
+            } else {
+                n = (m_iop == IOp::READ) ? read(m_fd, m_ptr, m_len) : write(m_fd, m_ptr, m_len);
+            }
             m_result = std::make_pair((n >= 0) ? n : 0, errno);
         } while (m_result.second == EINTR);
-        return m_result.second != EAGAIN;
+        if (m_result.second == EAGAIN) {
+            m_scheduler->record_eagain(m_fd);
+            return false;
+        }
+        return true;
     }
 
-    void await_suspend(std::coroutine_handle<> h) {
-        std::cout << "await_suspend\n";
+    template <typename P>
+    void await_suspend(std::coroutine_handle<P> h) {
+        TRACE("await_suspend fd " << m_fd);
         m_cohandle = h;
-        assert(m_scheduler->get_awaitables(m_fd) == nullptr);
-        m_scheduler->push_awaitables(m_fd, this);
+        if constexpr (STATS) {
+            m_suspended_at = std::chrono::steady_clock::now();
+        }
+        if (m_cancel) {
+            m_cancel->add(this);
+        }
+        if (m_scheduler->backend() == Backend::IO_URING) {
+            m_scheduler->submit_io(this);
+        } else {
+            m_scheduler->push_awaitables(this);
+        }
+        task_park(m_task_slot, &m_scheduler->task_table(), h, m_iop == IOp::READ ? WaitReason::READ : WaitReason::WRITE, m_fd);
     }
 
     AsyncIOResult await_resume() {
-        std::cout << "await_resume\n";
+        TRACE("await_resume fd " << m_fd << " result " << m_result.first << " errno " << m_result.second);
+        task_resume(m_task_slot);
+        m_scheduler->count_op();
+        m_scheduler->record_op(*this);
         return m_result; 
     }
 
@@ -63,94 +785,1238 @@ public:
     void * m_ptr;
     const size_t m_len;
     const IOp m_iop;
+    const iovec * const m_iov;
+    const int m_iovcnt;
 
     AsyncIOResult m_result;
 
     std::coroutine_handle<> m_cohandle;
+    // io_uring only: a POLL_ADD is in flight because the fd returned EAGAIN.
+    bool m_polling;
+    // epoll only: next waiter in the same fd direction queue.
+    Awaitable * m_next;
+    // Armed by with_deadline(), disarmed when the operation completes first.
+    Timer * m_deadline;
+    // io_uring only: the errno of a deadline or cancellation whose ASYNC_CANCEL is in flight.
+    int m_aborted;
+    // Set by the caller, linked into its token while parked.
+    CancellationToken * m_cancel;
+    Awaitable * m_cancel_prev;
+    Awaitable * m_cancel_next;
+    // PIPES_STATS only: set when the operation parks, for the latency histograms.
+    std::chrono::steady_clock::time_point m_suspended_at;
+    // Set when a traced coroutine parks, see taskstats.h.
+    TaskSlot * m_task_slot;
+};
+
+class SleepAwaitable {
+public:
+    bool await_ready() const { return m_timeout <= std::chrono::steady_clock::duration::zero(); }
+    template <typename P>
+    void await_suspend(std::coroutine_handle<P> h) {
+        m_timer.m_cohandle = h;
+        m_scheduler->add_timer(&m_timer, m_timeout);
+        task_park(m_task_slot, &m_scheduler->task_table(), h, WaitReason::SLEEP);
+    }
+    void await_resume() const { task_resume(m_task_slot); }
+
+public:
+    Scheduler * m_scheduler;
+    std::chrono::steady_clock::duration m_timeout;
+    Timer m_timer;
+    TaskSlot * m_task_slot;
+};
+
+class YieldAwaitable {
+public:
+    bool await_ready() const { return false; }
+    template <typename P>
+    void await_suspend(std::coroutine_handle<P> h) {
+        m_scheduler->post(h);
+        task_park(m_task_slot, &m_scheduler->task_table(), h, WaitReason::RUNNABLE);
+    }
+    void await_resume() const { task_resume(m_task_slot); }
+
+public:
+    Scheduler * m_scheduler;
+    TaskSlot * m_task_slot;
+};
+
+// Completes the wrapped async_read/async_write with {0, ETIMEDOUT} if it is
+// still pending when the timeout expires, whichever happens first disarms the other.
+class DeadlineAwaitable {
+public:
+    bool await_ready() { return m_io.await_ready(); }
+    template <typename P>
+    void await_suspend(std::coroutine_handle<P> h) {
+        m_timer.m_io = &m_io;
+        m_io.m_deadline = &m_timer;
+        m_io.await_suspend(h);
+        m_io.m_scheduler->add_timer(&m_timer, m_timeout);
+    }
+    AsyncIOResult await_resume() { return m_io.await_resume(); }
+
+public:
+    Awaitable m_io;
+    std::chrono::steady_clock::duration m_timeout;
+    Timer m_timer;
 };
 
-Awaitable Scheduler::async_io(int fd, void * ptr, size_t len, IOp iop) {
+DeadlineAwaitable with_deadline(Awaitable && io, std::chrono::steady_clock::duration timeout) {
+    return DeadlineAwaitable{.m_io = std::move(io), .m_timeout = timeout, .m_timer = {}};
+}
+
+void WaitQueue::push(Awaitable * awaitable) {
+    awaitable->m_next = nullptr;
+    if (tail) {
+        tail->m_next = awaitable;
+    } else {
+        head = awaitable;
+    }
+    tail = awaitable;
+}
+
+void CancellationToken::add(Awaitable * awaitable) {
+    awaitable->m_cancel_prev = nullptr;
+    awaitable->m_cancel_next = m_head;
+    if (m_head) {
+        m_head->m_cancel_prev = awaitable;
+    }
+    m_head = awaitable;
+}
+
+void CancellationToken::remove(Awaitable * awaitable) {
+    (awaitable->m_cancel_prev ? awaitable->m_cancel_prev->m_cancel_next : m_head) = awaitable->m_cancel_next;
+    if (awaitable->m_cancel_next) {
+        awaitable->m_cancel_next->m_cancel_prev = awaitable->m_cancel_prev;
+    }
+}
+
+void CancellationToken::cancel() {
+    m_cancelled = true;
+    // cancel_io() unlinks the head, whichever way the operation ends.
+    while (m_head) {
+        m_head->m_scheduler->cancel_io(m_head);
+    }
+}
+
+Awaitable * WaitQueue::pop() {
+    Awaitable * awaitable = head;
+    head = awaitable->m_next;
+    if (!head) {
+        tail = nullptr;
+    }
+    return awaitable;
+}
+
+bool WaitQueue::remove(Awaitable * awaitable) {
+    Awaitable * prev = nullptr;
+    for (Awaitable * it = head; it; prev = it, it = it->m_next) {
+        if (it != awaitable) {
+            continue;
+        }
+        (prev ? prev->m_next : head) = it->m_next;
+        if (tail == it) {
+            tail = prev;
+        }
+        return true;
+    }
+    return false;
+}
+
+Awaitable Scheduler::async_io(int fd, void * ptr, size_t len, IOp iop, const iovec * iov, int iovcnt, CancellationToken * cancel) {
     return Awaitable{
     .m_scheduler = this,
     .m_fd = fd,
     .m_ptr = ptr,
     .m_len = len,
     .m_iop = iop,
+    .m_iov = iov,
+    .m_iovcnt = iovcnt,
     .m_result = {},
     .m_cohandle = nullptr,
+    .m_polling = false,
+    .m_next = nullptr,
+    .m_deadline = nullptr,
+    .m_aborted = 0,
+    .m_cancel = cancel,
+    .m_cancel_prev = nullptr,
+    .m_cancel_next = nullptr,
+    .m_suspended_at = {},
+    .m_task_slot = nullptr,
     };
 }
 
+void Scheduler::record_op(const Awaitable & awaitable) {
+    if constexpr (STATS) {
+        FdStats & stats = fd_state(awaitable.m_fd).stats;
+        ++stats.ops;
+        (awaitable.m_iop == IOp::READ ? stats.bytes_read : stats.bytes_written) += awaitable.m_result.first;
+        if (awaitable.m_suspended_at != std::chrono::steady_clock::time_point{}) {
+            const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - awaitable.m_suspended_at).count();
+            (awaitable.m_iop == IOp::READ ? m_read_latency : m_write_latency).record(ns);
+        }
+    }
+}
 
+SchedulerStats Scheduler::snapshot() const {
+    SchedulerStats stats{.syscalls = m_syscalls, .ops = m_ops, .timers = m_timers.size(), .fds = {}, .read_latency = m_read_latency, .write_latency = m_write_latency};
+    for (size_t fd = 0; fd < m_fds.size(); ++fd) {
+        if (m_fds[fd].stats.ops || m_fds[fd].stats.eagain) {
+            stats.fds.emplace_back(static_cast<int>(fd), m_fds[fd].stats);
+        }
+    }
+    return stats;
+}
 
-Awaitable Scheduler::async_read(int fd, void *ptr, size_t len) {
-    return async_io(fd, ptr, len, IOp::READ);
+SleepAwaitable Scheduler::sleep_for(std::chrono::steady_clock::duration timeout) {
+    return SleepAwaitable{.m_scheduler = this, .m_timeout = timeout, .m_timer = {}, .m_task_slot = nullptr};
 }
 
-Awaitable Scheduler::async_write(int fd, const void * ptr, size_t len) {
-    return async_io(fd, const_cast<void*>(ptr), len, IOp::WRITE);
+YieldAwaitable Scheduler::yield() {
+    return YieldAwaitable{.m_scheduler = this, .m_task_slot = nullptr};
 }
 
-int Scheduler::pump_events() {
-    pollfd polls[MAX_EXCLUSIVE_FD];
-    int num_p = 0;
-    for (int fd = 0; fd < MAX_EXCLUSIVE_FD; ++fd) {
-        if (m_awaitables[fd] == nullptr) {
-            continue;
-        }
-        polls[num_p].fd = fd;
-        polls[num_p].events = (m_awaitables[fd]->m_iop == IOp::READ) ? POLLIN : POLLOUT;
-        polls[num_p].revents = 0;
-        num_p++;
+
+
+Scheduler::Scheduler(Backend backend) : m_epfd(epoll_create1(EPOLL_CLOEXEC)) {
+    assert(m_epfd >= 0);
+    if (backend == Backend::IO_URING && !m_uring.init(IO_URING_ENTRIES)) {
+        std::cerr << "io_uring unavailable, falling back to epoll\n";
     }
+}
 
-    if (poll(polls, num_p, -1) < 0) {
-        return (errno != EINTR) ? errno : 0;
+void Scheduler::submit_io(Awaitable * awaitable) {
+    io_uring_sqe * sqe = m_uring.get_sqe();
+    while (!sqe) {
+        m_uring.enter(0);
+        count_syscall();
+        sqe = m_uring.get_sqe();
+    }
+    sqe->fd = awaitable->m_fd;
+    sqe->user_data = reinterpret_cast<__u64>(awaitable);
+    if (awaitable->m_polling) {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = (awaitable->m_iop == IOp::READ) ? POLLIN : POLLOUT;
+        return;
     }
+    if (awaitable->m_iov) {
+        sqe->opcode = (awaitable->m_iop == IOp::READ) ? IORING_OP_READV : IORING_OP_WRITEV;
+        sqe->addr = reinterpret_cast<__u64>(awaitable->m_iov);
+        sqe->len = static_cast<__u32>(awaitable->m_iovcnt);
+    } else {
+        sqe->opcode = (awaitable->m_iop == IOp::READ) ? IORING_OP_READ : IORING_OP_WRITE;
+        sqe->addr = reinterpret_cast<__u64>(awaitable->m_ptr);
+        sqe->len = static_cast<__u32>(awaitable->m_len);
+    }
+    // Pipes and sockets are not seekable, -1 means "use the current file position".
+    sqe->off = static_cast<__u64>(-1);
+}
 
-    std::coroutine_handle<> cohandles[MAX_EXCLUSIVE_FD];
-    int num_c = 0;
-    for (int i = 0; i < num_p; ++i) {
-        if (polls[i].revents == 0) {
-            continue;
+void Scheduler::arm_uring_timeout(int timeout) {
+    const uint64_t due = m_timers.now() + timeout;
+    if (m_uring_timeout_armed && m_uring_timeout_due <= due) {
+        return;
+    }
+    io_uring_sqe * sqe = m_uring.get_sqe();
+    while (!sqe) {
+        m_uring.enter(0);
+        count_syscall();
+        sqe = m_uring.get_sqe();
+    }
+    // The kernel copies the timespec while preparing the request, one buffer is enough.
+    m_uring_timeout.tv_sec = timeout / 1000;
+    m_uring_timeout.tv_nsec = (timeout % 1000) * 1000000L;
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<__u64>(&m_uring_timeout);
+    sqe->len = 1;
+    sqe->user_data = TIMEOUT_USER_DATA;
+    m_uring_timeout_armed = true;
+    m_uring_timeout_due = due;
+}
+
+int Scheduler::pump_uring(bool block) {
+    if (int timeout = m_timers.next_timeout(); block && timeout >= 0) {
+        arm_uring_timeout(timeout);
+    }
+    int rc = m_uring.enter(block ? 1 : 0);
+    count_syscall();
+    if (block) {
+        m_tasks.tick();
+    }
+    if (rc < 0 && rc != -EINTR && rc != -EBUSY && rc != -ETIME) {
+        return -rc;
+    }
+
+    m_ready.clear();
+    m_uring.for_each_cqe([this](const io_uring_cqe & cqe) {
+        if (cqe.user_data == TIMEOUT_USER_DATA) {
+            m_uring_timeout_armed = false;
+            return;
         }
-        int fd = polls[i].fd;
-        Awaitable* awaitable = m_awaitables[fd];
-        if (!awaitable) {
-            continue;
+        if (cqe.user_data == CANCEL_USER_DATA) {
+            return;
         }
-        std::coroutine_handle<> cohandle= awaitable->retry();
-        if(!cohandle) {
-            continue;
+        Awaitable * awaitable = reinterpret_cast<Awaitable*>(cqe.user_data);
+        if (awaitable->m_aborted && (awaitable->m_polling || cqe.res == -ECANCELED || cqe.res == -EAGAIN)) {
+            // The deadline or cancellation won, the poll or the operation itself was cancelled.
+            awaitable->m_polling = false;
+            awaitable->m_result = std::make_pair(0, awaitable->m_aborted);
+            task_wake(awaitable->m_task_slot);
+            m_ready.push_back(awaitable->m_cohandle);
+            return;
         }
-        
-        m_awaitables[fd] = nullptr;
-        cohandles[num_c++] = cohandle;
-    }
+        if (awaitable->m_polling) {
+            // The fd became ready, reissue the actual read or write.
+            awaitable->m_polling = false;
+            submit_io(awaitable);
+            return;
+        }
+        if (cqe.res == -EAGAIN) {
+            record_eagain(awaitable->m_fd);
+            // O_NONBLOCK fds complete with EAGAIN instead of waiting, park on a poll first.
+            awaitable->m_polling = true;
+            submit_io(awaitable);
+            return;
+        }
+        awaitable->m_result = std::make_pair((cqe.res >= 0) ? cqe.res : 0, (cqe.res >= 0) ? 0 : -cqe.res);
+        finish(awaitable);
+    });
+    expire_timers();
 
-    for (int i = 0; i< num_c; ++i) {
-        cohandles[i].resume();
+    for (std::coroutine_handle<> cohandle : m_ready) {
+        TaskTrampoline::resume(cohandle);
     }
     return 0;
 }
 
-class Coro { 
-public:
-    class promise_type {
-    public :
-        Coro get_return_object() { return {}; }
-        std::suspend_never initial_suspend() noexcept { return {}; }
-        std::suspend_never final_suspend() noexcept { return {}; }
-        void return_void() {}
-        void unhandled_exception() { };
-    };
-};
+Scheduler::~Scheduler() {
+    close(m_epfd);
+}
 
-Coro fizz(Scheduler * scheduler, const int fizz_pipe_end) {
-    while(true) {
-        co_await scheduler->async_write(fizz_pipe_end, "Tick1", 5);
-        co_await scheduler->async_write(fizz_pipe_end, "Tick1", 5);
-        co_await scheduler->async_write(fizz_pipe_end, "Fizz", 4);
+void Scheduler::push_awaitables(Awaitable * awaitable) {
+    const int fd = awaitable->m_fd;
+    assert(fd >= 0);
+    FdState & state = fd_state(fd);
+    ((awaitable->m_iop == IOp::READ) ? state.readers : state.writers).push(awaitable);
+    if (!state.registered) {
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.fd = fd;
+        [[maybe_unused]] int rc = epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev);
+        assert(rc == 0);
+        state.registered = true;
+    }
+}
+
+void Scheduler::forget_fd(int fd) {
+    if (static_cast<size_t>(fd) >= m_fds.size() || !m_fds[fd].registered) {
+        return;
+    }
+    epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, nullptr);
+    // Without the registration no edge would ever resume them.
+    FdState & state = m_fds[fd];
+    for (WaitQueue * queue : {&state.readers, &state.writers}) {
+        while (!queue->empty()) {
+            cancel_io(queue->head);
+        }
+    }
+    m_fds[fd] = FdState{};
+}
+
+void Scheduler::wake_queue(WaitQueue & queue) {
+    while (!queue.empty()) {
+        if (!queue.head->retry()) {
+            break;
+        }
+        finish(queue.pop());
+    }
+}
+
+void Scheduler::finish(Awaitable * awaitable) {
+    if (awaitable->m_deadline) {
+        m_timers.cancel(awaitable->m_deadline);
+        awaitable->m_deadline = nullptr;
+    }
+    if (awaitable->m_cancel) {
+        awaitable->m_cancel->remove(awaitable);
+        awaitable->m_cancel = nullptr;
+    }
+    task_wake(awaitable->m_task_slot);
+    m_ready.push_back(awaitable->m_cohandle);
+}
+
+std::coroutine_handle<> Scheduler::abort(Awaitable * awaitable, int err) {
+    if (awaitable->m_deadline) {
+        m_timers.cancel(awaitable->m_deadline);
+        awaitable->m_deadline = nullptr;
+    }
+    if (awaitable->m_cancel) {
+        awaitable->m_cancel->remove(awaitable);
+        awaitable->m_cancel = nullptr;
+    }
+    if (backend() == Backend::IO_URING) {
+        awaitable->m_aborted = err;
+        io_uring_sqe * sqe = m_uring.get_sqe();
+        while (!sqe) {
+            m_uring.enter(0);
+            count_syscall();
+            sqe = m_uring.get_sqe();
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast<__u64>(awaitable);
+        sqe->user_data = CANCEL_USER_DATA;
+        return nullptr;
+    }
+    FdState & state = m_fds[awaitable->m_fd];
+    if ((awaitable->m_iop == IOp::READ ? state.readers : state.writers).remove(awaitable)) {
+        awaitable->m_result = std::make_pair(0, err);
+        task_wake(awaitable->m_task_slot);
+        return awaitable->m_cohandle;
+    }
+    return nullptr;
+}
+
+void Scheduler::time_out(Awaitable * awaitable) {
+    // The timer has fired already, there is nothing to disarm.
+    awaitable->m_deadline = nullptr;
+    if (std::coroutine_handle<> cohandle = abort(awaitable, ETIMEDOUT)) {
+        m_ready.push_back(cohandle);
+    }
+}
+
+void Scheduler::cancel_io(Awaitable * awaitable) {
+    if (std::coroutine_handle<> cohandle = abort(awaitable, ECANCELED)) {
+        post(cohandle);
+    }
+}
+
+void Scheduler::expire_timers() {
+    m_timers.advance(m_timers.now(), [this](Timer * timer) {
+        if (timer->m_io) {
+            time_out(timer->m_io);
+        } else {
+            m_ready.push_back(timer->m_cohandle);
+        }
+    });
+}
+
+void Scheduler::wake(int fd, bool readable, bool writable) {
+    if (static_cast<size_t>(fd) >= m_fds.size()) {
+        return;
+    }
+    if (readable) {
+        wake_queue(m_fds[fd].readers);
+    }
+    if (writable) {
+        wake_queue(m_fds[fd].writers);
+    }
+}
+
+Awaitable Scheduler::async_read(int fd, void *ptr, size_t len, CancellationToken * cancel) {
+    return async_io(fd, ptr, len, IOp::READ, nullptr, 0, cancel);
+}
+
+Awaitable Scheduler::async_write(int fd, const void * ptr, size_t len, CancellationToken * cancel) {
+    return async_io(fd, const_cast<void*>(ptr), len, IOp::WRITE, nullptr, 0, cancel);
+}
+
+Awaitable Scheduler::async_readv(int fd, const iovec * iov, int iovcnt) {
+    return async_io(fd, nullptr, 0, IOp::READ, iov, iovcnt);
+}
+
+Awaitable Scheduler::async_writev(int fd, const iovec * iov, int iovcnt) {
+    return async_io(fd, nullptr, 0, IOp::WRITE, iov, iovcnt);
+}
+
+int Scheduler::pump_events() {
+    const bool block = !run_deferred();
+    if (backend() == Backend::IO_URING) {
+        return pump_uring(block);
+    }
+
+    epoll_event events[MAX_EPOLL_EVENTS];
+    int num_e = epoll_wait(m_epfd, events, MAX_EPOLL_EVENTS, block ? m_timers.next_timeout() : 0);
+    count_syscall();
+    if (block) {
+        m_tasks.tick();
+    }
+    if (num_e < 0) {
+        return (errno != EINTR) ? errno : 0;
+    }
+
+    m_ready.clear();
+    for (int i = 0; i < num_e; ++i) {
+        const uint32_t ev = events[i].events;
+        wake(events[i].data.fd, ev & (EPOLLIN | EPOLLHUP | EPOLLERR), ev & (EPOLLOUT | EPOLLHUP | EPOLLERR));
+    }
+    expire_timers();
+
+    for (std::coroutine_handle<> cohandle : m_ready) {
+        TaskTrampoline::resume(cohandle);
+    }
+    return 0;
+}
+
+int Scheduler::pump_events_poll() {
+    const bool block = !run_deferred();
+    std::vector<pollfd> polls;
+    for (int fd = 0; fd < static_cast<int>(m_fds.size()); ++fd) {
+        if (!has_waiters(fd)) {
+            continue;
+        }
+        polls.push_back({
+            .fd = fd,
+            .events = static_cast<short>((m_fds[fd].readers.empty() ? 0 : POLLIN) | (m_fds[fd].writers.empty() ? 0 : POLLOUT)),
+            .revents = 0,
+        });
+    }
+
+    count_syscall();
+    const int rc = poll(polls.data(), polls.size(), block ? m_timers.next_timeout() : 0);
+    if (block) {
+        m_tasks.tick();
+    }
+    if (rc < 0) {
+        return (errno != EINTR) ? errno : 0;
+    }
+
+    m_ready.clear();
+    for (const pollfd & p : polls) {
+        if (p.revents == 0) {
+            continue;
+        }
+        wake(p.fd, p.revents & (POLLIN | POLLHUP | POLLERR), p.revents & (POLLOUT | POLLHUP | POLLERR));
+    }
+    expire_timers();
+
+    for (std::coroutine_handle<> cohandle : m_ready) {
+        TaskTrampoline::resume(cohandle);
+    }
+    return 0;
+}
+
+class Coro { 
+public:
+    class promise_type : public PooledPromise, public TracedPromise {
+    public :
+        Coro get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { };
+    };
+};
+
+// Buffered output stream over one fd. A write that fits into the buffer is
+// copied and completes at once. The buffer goes out with one writev when a
+// write does not fit, at the start of the next pump_events() and on flush().
+// A write that does not fit suspends until its data has been written or
+// absorbed into the freed buffer, which is the backpressure on producers.
+// Waiters are resumed through Scheduler::post(). The writer must outlive
+// its pending writes, co_await flush() before dropping it.
+class AsyncWriter {
+public:
+    class WriteAwaitable {
+    public:
+        bool await_ready();
+        template <typename P>
+        void await_suspend(std::coroutine_handle<P> h);
+        AsyncIOResult await_resume() const {
+            task_resume(m_task_slot);
+            return m_result;
+        }
+
+    public:
+        AsyncWriter * m_writer;
+        const char * m_ptr;
+        size_t m_len;
+        // Bytes already handed to the kernel.
+        size_t m_written;
+        // flush() barrier, completes once everything queued before it is written.
+        bool m_flush;
+        AsyncIOResult m_result;
+        std::coroutine_handle<> m_cohandle;
+        WriteAwaitable * m_next;
+        TaskSlot * m_task_slot;
+    };
+
+    AsyncWriter(Scheduler & scheduler, int fd, size_t capacity = STREAM_BUFFER_SIZE)
+        : m_scheduler{scheduler}, m_fd{fd}, m_buf(capacity) {}
+    ~AsyncWriter() {
+        if (m_dirty) {
+            m_scheduler.forget_writer(this);
+        }
+    }
+    AsyncWriter(const AsyncWriter &) = delete;
+    AsyncWriter& operator=(const AsyncWriter &) = delete;
+
+    WriteAwaitable write(const void * ptr, size_t len) {
+        return WriteAwaitable{this, static_cast<const char*>(ptr), len, 0, false, {}, nullptr, nullptr, nullptr};
+    }
+    WriteAwaitable write(std::string_view data) { return write(data.data(), data.size()); }
+    WriteAwaitable flush() { return WriteAwaitable{this, nullptr, 0, 0, true, {}, nullptr, nullptr, nullptr}; }
+
+    size_t buffered() const { return m_size - m_offset; }
+    // Starts writing out buffered data unless a flush is already running.
+    void start_flush();
+    // Called by the Scheduler for writers registered with mark_dirty().
+    void flush_deferred() {
+        m_dirty = false;
+        start_flush();
+    }
+
+    // Number of writev calls issued, for benchmarking.
+    long flushes() const { return m_flushes; }
+
+private:
+    Coro flush_loop();
+    void append(const char * ptr, size_t len);
+    // Accounts written bytes to the buffer first, then to the queued writes in order.
+    void consume(size_t written);
+    // Posts queued writes that are done, copying the next ones into the buffer while they fit.
+    void complete();
+    void fail(int err);
+
+    Scheduler & m_scheduler;
+    const int m_fd;
+    std::vector<char> m_buf;
+    size_t m_offset = 0;
+    size_t m_size = 0;
+    WriteAwaitable * m_head = nullptr;
+    WriteAwaitable * m_tail = nullptr;
+    bool m_flushing = false;
+    bool m_dirty = false;
+    int m_error = 0;
+    long m_flushes = 0;
+};
+
+bool AsyncWriter::WriteAwaitable::await_ready() {
+    if (m_writer->m_error) {
+        m_result = std::make_pair(0, m_writer->m_error);
+        return true;
+    }
+    if (m_writer->m_head) {
+        return false;
+    }
+    if (m_flush) {
+        m_result = {};
+        return m_writer->buffered() == 0;
+    }
+    if (m_writer->m_size + m_len > m_writer->m_buf.size()) {
+        return false;
+    }
+    m_writer->append(m_ptr, m_len);
+    m_result = std::make_pair(static_cast<ssize_t>(m_len), 0);
+    return true;
+}
+
+template <typename P>
+void AsyncWriter::WriteAwaitable::await_suspend(std::coroutine_handle<P> h) {
+    m_cohandle = h;
+    m_next = nullptr;
+    (m_writer->m_tail ? m_writer->m_tail->m_next : m_writer->m_head) = this;
+    m_writer->m_tail = this;
+    // Before the flush, which may complete this write already.
+    task_park(m_task_slot, &m_writer->m_scheduler.task_table(), h, WaitReason::WRITE, m_writer->m_fd);
+    m_writer->start_flush();
+}
+
+void AsyncWriter::append(const char * ptr, size_t len) {
+    std::memcpy(m_buf.data() + m_size, ptr, len);
+    m_size += len;
+    if (!m_dirty) {
+        m_dirty = true;
+        m_scheduler.mark_dirty(this);
+    }
+}
+
+void AsyncWriter::start_flush() {
+    if (!m_flushing && (buffered() || m_head)) {
+        m_flushing = true;
+        flush_loop();
+    }
+}
+
+void AsyncWriter::consume(size_t written) {
+    const size_t from_buffer = std::min(written, buffered());
+    m_offset += from_buffer;
+    written -= from_buffer;
+    if (m_offset == m_size) {
+        m_offset = m_size = 0;
+    }
+    for (WriteAwaitable * w = m_head; w && written; w = w->m_next) {
+        const size_t n = std::min(written, w->m_len - w->m_written);
+        w->m_written += n;
+        written -= n;
+    }
+}
+
+void AsyncWriter::complete() {
+    while (WriteAwaitable * w = m_head) {
+        if (w->m_flush ? buffered() != 0 : (w->m_written < w->m_len && m_size + (w->m_len - w->m_written) > m_buf.size())) {
+            break;
+        }
+        if (!w->m_flush && w->m_written < w->m_len) {
+            // Everything before it is written, so the rest can wait in the buffer.
+            append(w->m_ptr + w->m_written, w->m_len - w->m_written);
+        }
+        m_head = w->m_next;
+        if (!m_head) {
+            m_tail = nullptr;
+        }
+        w->m_result = std::make_pair(static_cast<ssize_t>(w->m_len), 0);
+        task_wake(w->m_task_slot);
+        m_scheduler.post(w->m_cohandle);
+    }
+}
+
+void AsyncWriter::fail(int err) {
+    m_error = err;
+    m_offset = m_size = 0;
+    while (WriteAwaitable * w = m_head) {
+        m_head = w->m_next;
+        w->m_result = std::make_pair(static_cast<ssize_t>(w->m_written), err);
+        task_wake(w->m_task_slot);
+        m_scheduler.post(w->m_cohandle);
+    }
+    m_tail = nullptr;
+}
+
+Coro AsyncWriter::flush_loop() {
+    iovec iov[MAX_WRITEV_IOVECS];
+    while (true) {
+        complete();
+        int iovcnt = 0;
+        if (buffered()) {
+            iov[iovcnt++] = {m_buf.data() + m_offset, buffered()};
+        }
+        for (WriteAwaitable * w = m_head; w && iovcnt < MAX_WRITEV_IOVECS; w = w->m_next) {
+            if (w->m_written < w->m_len) {
+                iov[iovcnt++] = {const_cast<char*>(w->m_ptr) + w->m_written, w->m_len - w->m_written};
+            }
+        }
+        if (iovcnt == 0) {
+            break;
+        }
+        ++m_flushes;
+        AsyncIOResult result = co_await m_scheduler.async_writev(m_fd, iov, iovcnt);
+        if (result.second) {
+            fail(result.second);
+            break;
+        }
+        consume(result.first);
+    }
+    m_flushing = false;
+}
+
+// Buffered input stream over one fd. read() serves buffered bytes first. When
+// the buffer is empty it issues one readv that scatters into the caller's
+// memory and then into the buffer, so large reads avoid the copy and small
+// ones read ahead. Only one read may be pending at a time.
+class AsyncReader {
+public:
+    class ReadAwaitable {
+    public:
+        ReadAwaitable(AsyncReader & reader, void * ptr, size_t len)
+            : m_reader{reader}, m_ptr{ptr}, m_len{len},
+              m_iov{{ptr, len}, {reader.m_buf.data(), reader.m_buf.size()}},
+              m_io{reader.m_scheduler.async_readv(reader.m_fd, m_iov, 2)} {}
+
+        bool await_ready() {
+            if (m_reader.buffered()) {
+                m_result = std::make_pair(static_cast<ssize_t>(m_reader.take(m_ptr, m_len)), 0);
+                m_from_buffer = true;
+                return true;
+            }
+            return m_io.await_ready();
+        }
+        template <typename P>
+        void await_suspend(std::coroutine_handle<P> h) { m_io.await_suspend(h); }
+        AsyncIOResult await_resume() {
+            if (m_from_buffer) {
+                return m_result;
+            }
+            AsyncIOResult result = m_io.await_resume();
+            const size_t n = result.first;
+            if (n > m_len) {
+                m_reader.m_offset = 0;
+                m_reader.m_size = n - m_len;
+                result.first = m_len;
+            }
+            return result;
+        }
+
+    private:
+        AsyncReader & m_reader;
+        void * m_ptr;
+        size_t m_len;
+        iovec m_iov[2];
+        Awaitable m_io;
+        bool m_from_buffer = false;
+        AsyncIOResult m_result{};
+    };
+
+    AsyncReader(Scheduler & scheduler, int fd, size_t capacity = STREAM_BUFFER_SIZE)
+        : m_scheduler{scheduler}, m_fd{fd}, m_buf(capacity) {}
+    AsyncReader(const AsyncReader &) = delete;
+    AsyncReader& operator=(const AsyncReader &) = delete;
+
+    ReadAwaitable read(void * ptr, size_t len) { return ReadAwaitable{*this, ptr, len}; }
+    size_t buffered() const { return m_size - m_offset; }
+
+private:
+    size_t take(void * ptr, size_t len) {
+        const size_t n = std::min(len, buffered());
+        std::memcpy(ptr, m_buf.data() + m_offset, n);
+        m_offset += n;
+        return n;
+    }
+
+    Scheduler & m_scheduler;
+    const int m_fd;
+    std::vector<char> m_buf;
+    size_t m_offset = 0;
+    size_t m_size = 0;
+};
+
+// Pull-based stream whose body may co_await I/O on the Scheduler between
+// co_yields. It starts on the first next() and only runs while its consumer
+// is suspended in next(), so reads follow demand and unread data stays in the
+// kernel, which pushes back on the writer. Control passes both ways by
+// symmetric transfer. value() refers to the co_yield operand in the frame, it
+// is not copied and stays valid until the following next(). The consumer must
+// not drop the generator while it is suspended in next().
+//
+//     while (co_await lines.next()) { use(lines.value()); }
+template <typename T>
+class AsyncGenerator {
+public:
+    class promise_type : public PooledPromise, public TracedPromise {
+    public:
+        // Suspends the generator and resumes the consumer waiting in next().
+        class TransferAwaitable {
+        public:
+            bool await_ready() const noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<>) const noexcept { return m_consumer; }
+            void await_resume() const noexcept {}
+
+            std::coroutine_handle<> m_consumer;
+        };
+
+        AsyncGenerator get_return_object() {
+            return AsyncGenerator{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        TransferAwaitable final_suspend() noexcept {
+            task_finished();
+            return {m_consumer};
+        }
+        TransferAwaitable yield_value(const T & value) noexcept {
+            m_current = std::addressof(value);
+            return {m_consumer};
+        }
+        void return_void() {}
+        void unhandled_exception() {}
+
+        const T * m_current = nullptr;
+        std::coroutine_handle<> m_consumer;
+    };
+
+    // Resumes the generator until its next co_yield, true if it produced a value.
+    class NextAwaitable {
+    public:
+        bool await_ready() const noexcept { return !m_cohandle || m_cohandle.done(); }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> consumer) const noexcept {
+            m_cohandle.promise().m_consumer = consumer;
+            task_borrow(m_cohandle.promise(), consumer);
+            return m_cohandle;
+        }
+        bool await_resume() const noexcept { return m_cohandle && !m_cohandle.done(); }
+
+        std::coroutine_handle<promise_type> m_cohandle;
+    };
+
+    AsyncGenerator(AsyncGenerator && other) : m_cohandle{std::exchange(other.m_cohandle, nullptr)} {}
+    AsyncGenerator& operator=(AsyncGenerator && other) {
+        if (this != &other) {
+            if (m_cohandle) {
+                m_cohandle.destroy();
+            }
+            m_cohandle = std::exchange(other.m_cohandle, nullptr);
+        }
+        return *this;
+    }
+    ~AsyncGenerator() {
+        if (m_cohandle) {
+            m_cohandle.destroy();
+        }
+    }
+
+    NextAwaitable next() { return NextAwaitable{m_cohandle}; }
+    const T & value() const { return *m_cohandle.promise().m_current; }
+
+private:
+    explicit AsyncGenerator(std::coroutine_handle<promise_type> cohandle) : m_cohandle{cohandle} {}
+
+    std::coroutine_handle<promise_type> m_cohandle;
+};
+
+// Yields the lines of fd without their '\n', a trailing unterminated line
+// included. The views point into one buffer that is refilled in place, so no
+// line is copied. It starts at capacity bytes and doubles when a line does
+// not fit. A read error ends the stream like EOF and is stored in *error.
+AsyncGenerator<std::string_view> read_lines(Scheduler * scheduler, const int fd, int * error = nullptr, size_t capacity = LINE_BUFFER_SIZE) {
+    std::vector<char> buf(capacity);
+    size_t begin = 0;
+    size_t end = 0;
+    // Bytes of the partial line at begin that are known to hold no '\n'.
+    size_t scanned = 0;
+    while (true) {
+        char * line = buf.data() + begin;
+        if (char * nl = static_cast<char*>(std::memchr(line + scanned, '\n', end - begin - scanned))) {
+            co_yield std::string_view{line, static_cast<size_t>(nl - line)};
+            begin += nl - line + 1;
+            scanned = 0;
+            continue;
+        }
+        scanned = end - begin;
+        if (begin) {
+            std::memmove(buf.data(), line, scanned);
+            begin = 0;
+            end = scanned;
+        }
+        if (end == buf.size()) {
+            buf.resize(buf.size() * 2);
+        }
+        AsyncIOResult result = co_await scheduler->async_read(fd, buf.data() + end, buf.size() - end);
+        if (result.second || result.first == 0) {
+            if (error) {
+                *error = result.second;
+            }
+            if (end > begin) {
+                co_yield std::string_view{buf.data() + begin, end - begin};
+            }
+            co_return;
+        }
+        end += result.first;
+    }
+}
+
+template <typename T = void>
+class Task;
+class TaskGroup;
+
+// The part of a Task promise that does not depend on the result type.
+class TaskPromiseBase : public PooledPromise, public TracedPromise {
+public:
+    class FinalAwaitable {
+    public:
+        bool await_ready() const noexcept { return false; }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) const noexcept {
+            h.promise().task_finished();
+            return TaskTrampoline::transfer(h.promise().completed());
+        }
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaitable final_suspend() noexcept { return {}; }
+
+    // Where control goes when the body is done: the awaiting coroutine, or
+    // for a child of when_all()/when_any() whatever its group decides.
+    std::coroutine_handle<> completed();
+
+    std::coroutine_handle<> m_continuation;
+    TaskGroup * m_group = nullptr;
+    size_t m_index = 0;
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase {
+public:
+    Task<T> get_return_object();
+    void return_value(T value) { m_result.template emplace<1>(std::move(value)); }
+    void unhandled_exception() { m_result.template emplace<2>(std::current_exception()); }
+    T result() {
+        if (m_result.index() == 2) {
+            std::rethrow_exception(std::get<2>(m_result));
+        }
+        return std::move(std::get<1>(m_result));
+    }
+
+    // The value or the exception in one, which keeps the frames of small
+    // tasks within a pool class.
+    std::variant<std::monostate, T, std::exception_ptr> m_result;
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase {
+public:
+    Task<void> get_return_object();
+    void return_void() {}
+    void unhandled_exception() { m_exception = std::current_exception(); }
+    void result() {
+        if (m_exception) {
+            std::rethrow_exception(m_exception);
+        }
+    }
+    std::exception_ptr m_exception;
+};
+
+// Lazy coroutine with a result. The body starts when the task is awaited and
+// its completion resumes the awaiter by symmetric transfer, so co_await
+// chains of any depth run in bounded stack, through a TaskTrampoline where the
+// transfer is no tail call. Exceptions are rethrown to the awaiter. Await a
+// task at most once.
+template <typename T>
+class Task {
+public:
+    using promise_type = TaskPromise<T>;
+    using handle = std::coroutine_handle<promise_type>;
+
+    class TaskAwaitable {
+    public:
+        bool await_ready() const noexcept { return false; }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) const noexcept {
+            m_cohandle.promise().m_continuation = h;
+            task_borrow(m_cohandle.promise(), h);
+            if (!TaskTrampoline::active()) [[unlikely]] {
+                // Awaited from outside any trampoline, as by run_task().
+                return TaskTrampoline::run(m_cohandle, h);
+            }
+            return TaskTrampoline::transfer(m_cohandle);
+        }
+        T await_resume() const { return m_cohandle.promise().result(); }
+
+        handle m_cohandle;
+    };
+
+    explicit Task(handle cohandle) : m_cohandle{cohandle} {}
+    Task(Task && other) : m_cohandle{std::exchange(other.m_cohandle, nullptr)} {}
+    Task& operator=(Task && other) {
+        if (this != &other) {
+            if (m_cohandle) {
+                m_cohandle.destroy();
+            }
+            m_cohandle = std::exchange(other.m_cohandle, nullptr);
+        }
+        return *this;
+    }
+    ~Task() {
+        if (m_cohandle) {
+            m_cohandle.destroy();
+        }
+    }
+
+    TaskAwaitable operator co_await() const noexcept { return TaskAwaitable{m_cohandle}; }
+    bool is_done() const { return m_cohandle.done(); }
+    T result() const { return m_cohandle.promise().result(); }
+    promise_type & promise() const { return m_cohandle.promise(); }
+    handle cohandle() const { return m_cohandle; }
+
+private:
+    handle m_cohandle;
+};
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() {
+    return Task<T>{std::coroutine_handle<TaskPromise<T>>::from_promise(*this)};
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+    return Task<void>{std::coroutine_handle<TaskPromise<void>>::from_promise(*this)};
+}
+
+// Runs the tasks of a when_all()/when_any() concurrently. co_await start()
+// resumes each child until it first suspends and the awaiter continues once
+// needed of them are done. Children completing during start() do not resume
+// it, and children not started yet when enough are done are never started.
+// A group that has to outlive its awaiter, with the losers of when_any()
+// still running, is orphaned by release() and deletes itself with the last.
+class TaskGroup {
+public:
+    class StartAwaitable {
+    public:
+        bool await_ready() const { return m_group->m_children.empty(); }
+        // Parked before start() runs the children, which may complete the group right away.
+        template <typename P>
+        bool await_suspend(std::coroutine_handle<P> h) {
+            task_park(m_task_slot, nullptr, h, WaitReason::AWAIT);
+            return m_group->start(h);
+        }
+        void await_resume() const { task_resume(m_task_slot); }
+
+        TaskGroup * m_group;
+        TaskSlot * m_task_slot = nullptr;
+    };
+
+    // Deleter for heap allocated groups.
+    struct Release {
+        void operator()(TaskGroup * group) const { group->release(); }
+    };
+
+    explicit TaskGroup(size_t needed) : m_needed{needed} {}
+    virtual ~TaskGroup() = default;
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup& operator=(const TaskGroup &) = delete;
+
+    template <typename T>
+    void add(const Task<T> & task) {
+        task.promise().m_group = this;
+        task.promise().m_index = m_children.size();
+        m_children.push_back(task.cohandle());
+    }
+    StartAwaitable start() { return StartAwaitable{this}; }
+    size_t winner() const { return m_winner; }
+
+    std::coroutine_handle<> complete(size_t index) {
+        if (m_completed++ == 0) {
+            m_winner = index;
+        }
+        --m_running;
+        if (m_waiting && m_completed == m_needed) {
+            m_waiting = false;
+            return m_awaiter;
+        }
+        if (m_orphaned && m_running == 0) {
+            delete this;
+        }
+        return std::noop_coroutine();
+    }
+
+    void release() {
+        if (m_running == 0) {
+            delete this;
+        } else {
+            m_orphaned = true;
+        }
+    }
+
+private:
+    bool start(std::coroutine_handle<> awaiter) {
+        m_awaiter = awaiter;
+        for (size_t i = 0; i < m_children.size() && m_completed < m_needed; ++i) {
+            ++m_running;
+            TaskTrampoline::resume(m_children[i]);
+        }
+        m_waiting = m_completed < m_needed;
+        return m_waiting;
+    }
+
+    std::vector<std::coroutine_handle<>> m_children;
+    const size_t m_needed;
+    size_t m_completed = 0;
+    size_t m_running = 0;
+    size_t m_winner = 0;
+    std::coroutine_handle<> m_awaiter;
+    bool m_waiting = false;
+    bool m_orphaned = false;
+};
+
+inline std::coroutine_handle<> TaskPromiseBase::completed() {
+    if (m_group) {
+        return m_group->complete(m_index);
+    }
+    return m_continuation ? m_continuation : std::noop_coroutine();
+}
+
+// Group that owns its tasks, for when_any() where it may outlive the awaiter.
+template <typename T>
+class OwningTaskGroup : public TaskGroup {
+public:
+    OwningTaskGroup(size_t needed, std::vector<Task<T>> tasks) : TaskGroup{needed}, m_tasks{std::move(tasks)} {
+        for (const Task<T> & task : m_tasks) {
+            add(task);
+        }
+    }
+
+    std::vector<Task<T>> m_tasks;
+};
+
+// Runs all tasks concurrently and returns their results in order once every
+// one is done. An exception is rethrown after all of them have finished.
+template <typename... Ts>
+Task<std::tuple<Ts...>> when_all(Task<Ts>... tasks) {
+    TaskGroup group{sizeof...(Ts)};
+    (group.add(tasks), ...);
+    co_await group.start();
+    co_return std::tuple<Ts...>{tasks.result()...};
+}
+
+template <typename T>
+Task<std::vector<T>> when_all(std::vector<Task<T>> tasks) {
+    TaskGroup group{tasks.size()};
+    for (const Task<T> & task : tasks) {
+        group.add(task);
+    }
+    co_await group.start();
+    std::vector<T> results;
+    results.reserve(tasks.size());
+    for (const Task<T> & task : tasks) {
+        results.push_back(task.result());
+    }
+    co_return results;
+}
+
+// Runs the tasks concurrently and returns the index and result of the first
+// one done. The others keep running to completion in the background and
+// their results are dropped, so whatever they refer to must outlive them,
+// bound them with with_deadline() where that matters.
+template <typename T>
+Task<std::pair<size_t, T>> when_any(std::vector<Task<T>> tasks) {
+    assert(!tasks.empty());
+    std::unique_ptr<OwningTaskGroup<T>, TaskGroup::Release> group{new OwningTaskGroup<T>{1, std::move(tasks)}};
+    co_await group->start();
+    const size_t winner = group->winner();
+    co_return std::pair<size_t, T>{winner, group->m_tasks[winner].result()};
+}
+
+template <typename T, typename... Ts>
+    requires (std::same_as<T, Ts> && ...)
+Task<std::pair<size_t, T>> when_any(Task<T> first, Task<Ts>... rest) {
+    std::vector<Task<T>> tasks;
+    tasks.reserve(1 + sizeof...(rest));
+    tasks.push_back(std::move(first));
+    (tasks.push_back(std::move(rest)), ...);
+    co_return co_await when_any(std::move(tasks));
+}
+
+// Runs a task from plain code, *done is set once it has finished.
+template <typename T>
+Coro run_task(Task<T> task, bool * done) {
+    co_await task;
+    *done = true;
+}
+
+bool Scheduler::run_deferred() {
+    bool ran = false;
+    while (!m_dirty.empty() || !m_posted.empty()) {
+        std::vector<AsyncWriter*> dirty;
+        dirty.swap(m_dirty);
+        for (AsyncWriter * writer : dirty) {
+            writer->flush_deferred();
+        }
+        std::vector<std::coroutine_handle<>> posted;
+        posted.swap(m_posted);
+        for (std::coroutine_handle<> cohandle : posted) {
+            TaskTrampoline::resume(cohandle);
+            ran = true;
+        }
+    }
+    return ran;
+}
+
+Coro fizz(Scheduler * scheduler, const int fizz_pipe_end) {
+    while(true) {
+        co_await scheduler->async_write(fizz_pipe_end, "Tick1", 5);
+        co_await scheduler->async_write(fizz_pipe_end, "Tick1", 5);
+        co_await scheduler->async_write(fizz_pipe_end, "Fizz", 4);
     }
 }
 
@@ -164,84 +2030,859 @@ Coro buzz(Scheduler * scheduler, const int buzz_pipe_end) {
     }
 }
 
-Coro consume(Scheduler * scheduler, bool *done, const int fizz_pipe_end, const int buzz_pipe_end, const int timerfd) {
+Coro consume(Scheduler * scheduler, bool *done, const int fizz_pipe_end, const int buzz_pipe_end) {
     static constexpr int stdout_fd = 1;
+    AsyncWriter out{*scheduler, stdout_fd};
     int iteration = 1;
     char buf[64];
+    auto next_tick = std::chrono::steady_clock::now();
     while (true) { 
-        size_t num_timer_events;
-        co_await scheduler->async_read(timerfd, &num_timer_events, sizeof(num_timer_events));
+        // Sleep to the next 100ms boundary and catch up on any ticks missed meanwhile.
+        next_tick += std::chrono::milliseconds(100);
+        co_await scheduler->sleep_for(next_tick - std::chrono::steady_clock::now());
+        size_t num_timer_events = 1;
+        for (auto now = std::chrono::steady_clock::now(); now >= next_tick + std::chrono::milliseconds(100); next_tick += std::chrono::milliseconds(100)) {
+            ++num_timer_events;
+        }
         while (num_timer_events--) {
             bool fizzy_buzzy = false;
             AsyncIOResult fizz_result = co_await scheduler->async_read(fizz_pipe_end, buf, sizeof(buf));
             if (fizz_result.first == 4) {
                 fizzy_buzzy = true;
-                write(stdout_fd, buf, 4);
+                co_await out.write(buf, 4);
             }
 
             AsyncIOResult buzz_result = co_await scheduler->async_read(buzz_pipe_end, buf, sizeof(buf));
             if (buzz_result.first == 4) {
                 fizzy_buzzy = true;
-                write(stdout_fd, buf, 4);
+                co_await out.write(buf, 4);
             }
 
             if(!fizzy_buzzy) {
                 if (size_t n = snprintf(buf, sizeof(buf), "%d", iteration); n < sizeof(buf)) {
-                    write(stdout_fd, buf, n);
+                    co_await out.write(buf, n);
                 }
             }
         }
 
-        write(stdout_fd, "\n", 1);
+        co_await out.write("\n");
 
         if (iteration++ == 20) {
+            co_await out.flush();
             *done=true;
             co_return;
         }
     }
 }
 
-int main() {
+Coro bench_reader(Scheduler * scheduler, int *live, long *reads, const int pipe_end) {
+    char c;
+    ++*live;
+    while (true) {
+        AsyncIOResult result = co_await scheduler->async_read(pipe_end, &c, 1);
+        if (result.first == 0) {
+            break;
+        }
+        ++*reads;
+    }
+    --*live;
+}
+
+// Compares the legacy poll() pump with the epoll pump: num_idle readers parked
+// on pipes that never become ready plus one pipe that is made readable before
+// every pump iteration.
+int bench_pump(int num_idle, int iterations) {
+    rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < 2 * static_cast<rlim_t>(num_idle) + 16) {
+        num_idle = static_cast<int>((rl.rlim_cur - 16) / 2);
+    }
+
+    std::vector<int> write_ends;
+    Scheduler s;
+    int live = 0;
+    long reads = 0;
+    std::streambuf * cout_buf = std::cout.rdbuf(nullptr);
+    for (int i = 0; i <= num_idle; ++i) {
+        int fds[2];
+        if (pipe2(fds, O_NONBLOCK) < 0) {
+            std::cout.rdbuf(cout_buf);
+            std::cerr << "pipe2 failed after " << i << " pipes, raise RLIMIT_NOFILE\n";
+            return errno;
+        }
+        write_ends.push_back(fds[1]);
+        bench_reader(&s, &live, &reads, fds[0]);
+    }
+    const int active_fd = write_ends.back();
+
+    auto run = [&](int (Scheduler::*pump)()) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            write(active_fd, "x", 1);
+            (s.*pump)();
+        }
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+    };
+    double poll_ns = run(&Scheduler::pump_events_poll);
+    double epoll_ns = run(&Scheduler::pump_events);
+
+    for (int fd : write_ends) {
+        close(fd);
+    }
+    while (live > 0) {
+        s.pump_events();
+    }
+    std::cout.rdbuf(cout_buf);
+
+    std::cout << "idle fds " << num_idle << ", iterations " << iterations << ", reads " << reads << "\n";
+    std::cout << "pump_events_poll " << poll_ns << " ns/iter\n";
+    std::cout << "pump_events      " << epoll_ns << " ns/iter\n";
+    return 0;
+}
+
+// The fizz/buzz producers against a consumer without the timer or stdout.
+Coro bench_consume(Scheduler * scheduler, bool *done, long messages, const int fizz_pipe_end, const int buzz_pipe_end) {
+    char buf[64];
+    for (long i = 0; i < messages; i += 2) {
+        co_await scheduler->async_read(fizz_pipe_end, buf, sizeof(buf));
+        co_await scheduler->async_read(buzz_pipe_end, buf, sizeof(buf));
+    }
+    *done = true;
+}
+
+int bench_backend(Backend backend, long messages) {
     int fizz_pipe_fds[2];
-    if (pipe2(fizz_pipe_fds, O_DIRECT | O_NONBLOCK) < 0) {
-        std::cerr<< "fizz pipe2 call failed\n";
+    int buzz_pipe_fds[2];
+    if (pipe2(fizz_pipe_fds, O_DIRECT | O_NONBLOCK) < 0 || pipe2(buzz_pipe_fds, O_DIRECT | O_NONBLOCK) < 0) {
+        std::cerr<< "pipe2 call failed\n";
         return errno;
     }
 
-    assert(fizz_pipe_fds[0] < MAX_EXCLUSIVE_FD);
-    assert(fizz_pipe_fds[1] < MAX_EXCLUSIVE_FD);
+    Scheduler s{backend};
+    bool done = false;
+    std::streambuf * cout_buf = std::cout.rdbuf(nullptr);
+    auto start = std::chrono::steady_clock::now();
+    fizz(&s, fizz_pipe_fds[1]);
+    buzz(&s, buzz_pipe_fds[1]);
+    bench_consume(&s, &done, messages, fizz_pipe_fds[0], buzz_pipe_fds[0]);
+    while (!done) {
+        if (int err = s.pump_events()) {
+            std::cout.rdbuf(cout_buf);
+            return err;
+        }
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout.rdbuf(cout_buf);
+
+    std::cout << ((s.backend() == Backend::IO_URING) ? "io_uring" : "epoll   ")
+              << " ops " << s.ops()
+              << ", syscalls/op " << static_cast<double>(s.syscalls()) / s.ops()
+              << ", " << s.ops() / secs << " ops/s\n";
+    if constexpr (STATS) {
+        std::cout << s.snapshot();
+    }
+    // The producers stay parked on the pipes, the frames are reclaimed at exit.
+    return 0;
+}
+
+Coro stream_producer(Scheduler * scheduler, bool buffered, const int fd, long messages) {
+    AsyncWriter out{*scheduler, fd};
+    for (long i = 0; i < messages; ++i) {
+        if (buffered) {
+            co_await out.write("Tick1", 5);
+        } else {
+            co_await scheduler->async_write(fd, "Tick1", 5);
+        }
+    }
+    co_await out.flush();
+}
 
-    int buzz_pipe_fds[2];
-    if (pipe2(buzz_pipe_fds, O_DIRECT | O_NONBLOCK) < 0) {
-        std::cerr<< "buzz pipe2 call failed\n";
+Coro stream_consumer(Scheduler * scheduler, bool *done, bool buffered, const int fd, long bytes) {
+    AsyncReader in{*scheduler, fd};
+    char buf[5];
+    while (bytes > 0) {
+        AsyncIOResult result = buffered ? co_await in.read(buf, sizeof(buf)) : co_await scheduler->async_read(fd, buf, sizeof(buf));
+        if (result.first == 0) {
+            break;
+        }
+        bytes -= result.first;
+    }
+    *done = true;
+}
+
+// 5 byte messages through a pipe, one syscall each against AsyncWriter/AsyncReader.
+int bench_stream(long messages) {
+    for (bool buffered : {false, true}) {
+        int fds[2];
+        if (pipe2(fds, O_NONBLOCK) < 0) {
+            std::cerr<< "pipe2 call failed\n";
+            return errno;
+        }
+        Scheduler s;
+        bool done = false;
+        std::streambuf * cout_buf = std::cout.rdbuf(nullptr);
+        auto start = std::chrono::steady_clock::now();
+        stream_consumer(&s, &done, buffered, fds[0], messages * 5);
+        stream_producer(&s, buffered, fds[1], messages);
+        while (!done) {
+            if (int err = s.pump_events()) {
+                std::cout.rdbuf(cout_buf);
+                return err;
+            }
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout.rdbuf(cout_buf);
+        std::cout << (buffered ? "buffered " : "direct   ") << messages << " messages, syscalls/message "
+                  << static_cast<double>(s.syscalls()) / messages << ", " << messages / secs << " messages/s\n";
+        close(fds[0]);
+        close(fds[1]);
+    }
+    return 0;
+}
+
+struct Sample {
+    std::string_view sensor;
+    long value;
+};
+
+// Second pipeline stage, "<sensor> <value>" lines into Samples that still point into the line buffer.
+AsyncGenerator<Sample> parse_samples(AsyncGenerator<std::string_view> lines) {
+    while (co_await lines.next()) {
+        std::string_view line = lines.value();
+        const size_t space = line.find(' ');
+        if (space == std::string_view::npos) {
+            continue;
+        }
+        Sample sample{line.substr(0, space), 0};
+        std::from_chars(line.data() + space + 1, line.data() + line.size(), sample.value);
+        co_yield sample;
+    }
+}
+
+// Writes block repeats times in 64 KiB chunks, then closes fd so the reader sees EOF.
+Coro block_producer(Scheduler * scheduler, std::string_view block, long repeats, const int fd) {
+    static constexpr size_t CHUNK = 65536;
+    while (repeats--) {
+        for (size_t offset = 0; offset < block.size();) {
+            AsyncIOResult result = co_await scheduler->async_write(fd, block.data() + offset, std::min(CHUNK, block.size() - offset));
+            if (result.second) {
+                repeats = 0;
+                break;
+            }
+            offset += result.first;
+        }
+    }
+    scheduler->forget_fd(fd);
+    close(fd);
+}
+
+Coro line_consumer(Scheduler * scheduler, bool *done, long *lines, long *sum, bool parse, const int fd) {
+    if (parse) {
+        AsyncGenerator<Sample> samples = parse_samples(read_lines(scheduler, fd));
+        while (co_await samples.next()) {
+            ++*lines;
+            *sum += samples.value().value;
+        }
+    } else {
+        AsyncGenerator<std::string_view> in = read_lines(scheduler, fd);
+        while (co_await in.next()) {
+            ++*lines;
+            *sum += in.value().size();
+        }
+    }
+    *done = true;
+}
+
+// 1024 "sensor-NN <value>" lines, about 20 bytes each.
+std::string sample_block() {
+    std::string block;
+    char line[64];
+    for (int i = 0; i < 1024; ++i) {
+        block.append(line, snprintf(line, sizeof(line), "sensor-%02d %d\n", i % 16, i * 1000));
+    }
+    return block;
+}
+
+// Streams repeats copies of block through a pipe into read_lines(), with parse
+// the Samples of parse_samples() on top. Returns the number of lines received.
+long lines_pipeline(Backend backend, std::string_view block, long repeats, bool parse, long * syscalls = nullptr) {
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK) < 0) {
+        std::cerr<< "pipe2 call failed\n";
+        return 0;
+    }
+    Scheduler s{backend};
+    bool done = false;
+    long lines = 0;
+    long sum = 0;
+    line_consumer(&s, &done, &lines, &sum, parse, fds[0]);
+    block_producer(&s, block, repeats, fds[1]);
+    while (!done && s.pump_events() == 0);
+    s.forget_fd(fds[0]);
+    close(fds[0]);
+    bench_keep(sum);
+    if (syscalls) {
+        *syscalls = s.syscalls();
+    }
+    return lines;
+}
+
+int bench_lines(long repeats) {
+    const std::string block = sample_block();
+    for (bool parse : {false, true}) {
+        long syscalls = 0;
+        auto start = std::chrono::steady_clock::now();
+        long lines = lines_pipeline(Backend::EPOLL, block, repeats, parse, &syscalls);
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (lines != repeats * 1024) {
+            std::cerr << "lost lines: " << lines << " of " << repeats * 1024 << "\n";
+            return EIO;
+        }
+        std::cout << (parse ? "parse_samples " : "read_lines    ") << lines << " lines, " << lines / secs << " lines/s, "
+                  << block.size() * repeats / secs / (1 << 20) << " MB/s, syscalls/line " << static_cast<double>(syscalls) / lines << "\n";
+    }
+    return 0;
+}
+
+// One frame and two symmetric transfers per level, the stack stays bounded at any depth.
+Task<long> chain(long depth) {
+    if (depth == 0) {
+        co_return 0;
+    }
+    co_return 1 + co_await chain(depth - 1);
+}
+
+long chain_depth(long depth) {
+    Task<long> task = chain(depth);
+    bool done = false;
+    run_task(std::move(task), &done);
+    return done ? depth : 0;
+}
+
+Task<long> read_byte(Scheduler * scheduler, const int fd) {
+    char c;
+    AsyncIOResult result = co_await scheduler->async_read(fd, &c, 1);
+    co_return result.first;
+}
+
+// Answers every byte on control with one byte to each fan-out pipe.
+Coro fanout_peer(Scheduler * scheduler, const int control, const std::vector<int> * outs, long rounds) {
+    char c = 'x';
+    while (rounds--) {
+        co_await scheduler->async_read(control, &c, 1);
+        for (int fd : *outs) {
+            co_await scheduler->async_write(fd, &c, 1);
+        }
+    }
+}
+
+Coro fanout_driver(Scheduler * scheduler, bool *done, const int control, const std::vector<int> * ins, long rounds, bool any) {
+    char c = 'x';
+    long total = 0;
+    while (rounds--) {
+        co_await scheduler->async_write(control, &c, 1);
+        std::vector<Task<long>> reads;
+        for (int fd : *ins) {
+            reads.push_back(read_byte(scheduler, fd));
+        }
+        if (any) {
+            total += (co_await when_any(std::move(reads))).second;
+            // The losers were woken by the same pump, let them take their bytes first.
+            co_await scheduler->yield();
+        } else {
+            for (long n : co_await when_all(std::move(reads))) {
+                total += n;
+            }
+        }
+    }
+    bench_keep(total);
+    *done = true;
+}
+
+// Request on a control pipe, answer on fanout pipes joined by when_all() or when_any().
+int fanout_rounds(long fanout, long rounds, bool any) {
+    int control[2];
+    if (pipe2(control, O_NONBLOCK) < 0) {
+        std::cerr<< "pipe2 call failed\n";
         return errno;
     }
+    std::vector<int> ins;
+    std::vector<int> outs;
+    for (long i = 0; i < fanout; ++i) {
+        int fds[2];
+        if (pipe2(fds, O_NONBLOCK) < 0) {
+            std::cerr<< "pipe2 call failed\n";
+            return errno;
+        }
+        ins.push_back(fds[0]);
+        outs.push_back(fds[1]);
+    }
+    {
+        Scheduler s;
+        bool done = false;
+        fanout_peer(&s, control[0], &outs, rounds);
+        fanout_driver(&s, &done, control[1], &ins, rounds, any);
+        while (!done) {
+            if (int err = s.pump_events()) {
+                return err;
+            }
+        }
+    }
+    for (int fd : {control[0], control[1]}) {
+        close(fd);
+    }
+    for (size_t i = 0; i < ins.size(); ++i) {
+        close(ins[i]);
+        close(outs[i]);
+    }
+    return 0;
+}
+
+struct Subscriber {
+    int read_fd;
+    int write_fd;
+    CancellationToken cancel;
+    // Start of the write in progress, zero while none is.
+    std::chrono::steady_clock::time_point writing_since{};
+    bool dropped = false;
+};
+
+// Sends message i at start + i * interval to every subscriber in turn, so one
+// that stops reading blocks the others once its pipe is full. Lateness runs
+// from when a message was due until it reached the last subscriber. Timers
+// tick in 1 ms, so a message due before the last wake-up counts from there.
+Coro broadcaster(Scheduler * scheduler, bool *done, const bool *stop, std::vector<Subscriber> * subs, LatencyHistogram * lateness,
+                 long *sent, long messages, std::chrono::steady_clock::time_point start, std::chrono::microseconds interval) {
+    char msg[512]{};
+    auto woke = start;
+    for (; *sent < messages && !*stop; ++*sent) {
+        const auto due = start + *sent * interval;
+        if (due > std::chrono::steady_clock::now()) {
+            co_await scheduler->sleep_for(due - std::chrono::steady_clock::now());
+            woke = std::chrono::steady_clock::now();
+        }
+        for (Subscriber & sub : *subs) {
+            if (sub.dropped) {
+                continue;
+            }
+            sub.writing_since = std::chrono::steady_clock::now();
+            AsyncIOResult result = co_await scheduler->async_write(sub.write_fd, msg, sizeof(msg), &sub.cancel);
+            sub.writing_since = {};
+            if (result.second) {
+                sub.dropped = true;
+            }
+        }
+        if (!*stop) {
+            lateness->record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - std::max(due, woke)).count());
+        }
+    }
+    *done = true;
+}
+
+Coro subscriber_reader(Scheduler * scheduler, int *live, const int fd) {
+    ++*live;
+    char buf[4096];
+    while ((co_await scheduler->async_read(fd, buf, sizeof(buf))).first > 0);
+    --*live;
+}
+
+// Sheds subscribers whose write has been pending for longer than shed_after.
+Coro watchdog(Scheduler * scheduler, int *live, bool *stop, std::vector<Subscriber> * subs, std::chrono::steady_clock::duration shed_after) {
+    ++*live;
+    while (!*stop) {
+        co_await scheduler->sleep_for(std::chrono::milliseconds(1));
+        const auto now = std::chrono::steady_clock::now();
+        for (Subscriber & sub : *subs) {
+            if (sub.writing_since != std::chrono::steady_clock::time_point{} && now - sub.writing_since > shed_after) {
+                sub.cancel.cancel();
+            }
+        }
+    }
+    --*live;
+}
+
+// One broadcaster, healthy subscribers and num_stuck that never read. The run
+// is cut off after twice its nominal length, messages not sent by then count
+// as late as the cut off. Every pending write is cancelled at the end, which
+// also lets the broadcaster unwind when nothing shed the stuck subscribers.
+int bench_stuck_peers(int num_healthy, int num_stuck, bool shed) {
+    static constexpr long MESSAGES = 5000;
+    static constexpr std::chrono::microseconds INTERVAL{100};
+    static constexpr std::chrono::milliseconds SHED_AFTER{2};
+    std::vector<Subscriber> subs(num_healthy + num_stuck);
+    for (Subscriber & sub : subs) {
+        int fds[2];
+        if (pipe2(fds, O_NONBLOCK) < 0) {
+            std::cerr<< "pipe2 call failed\n";
+            return errno;
+        }
+        sub.read_fd = fds[0];
+        sub.write_fd = fds[1];
+    }
+    // Spread the stuck ones out, the fan-out order matters for whom they block.
+    std::vector<bool> stuck(subs.size());
+    for (int i = 0; i < num_stuck; ++i) {
+        stuck[(i * 2 + 1) * subs.size() / (num_stuck * 2)] = true;
+    }
+
+    Scheduler s;
+    int live = 0;
+    bool stop = false;
+    bool done = false;
+    long sent = 0;
+    LatencyHistogram lateness;
+    for (size_t i = 0; i < subs.size(); ++i) {
+        if (!stuck[i]) {
+            subscriber_reader(&s, &live, subs[i].read_fd);
+        }
+    }
+    // Without shedding it only keeps the pump from blocking past the cut-off.
+    watchdog(&s, &live, &stop, &subs, shed ? std::chrono::steady_clock::duration{SHED_AFTER} : std::chrono::steady_clock::duration::max());
+    const auto start = std::chrono::steady_clock::now();
+    const auto cut_off = start + 2 * MESSAGES * INTERVAL;
+    broadcaster(&s, &done, &stop, &subs, &lateness, &sent, MESSAGES, start, INTERVAL);
+    while (!done && std::chrono::steady_clock::now() < cut_off) {
+        if (int err = s.pump_events()) {
+            return err;
+        }
+    }
+    const long unsent = MESSAGES - sent;
+    const auto now = std::chrono::steady_clock::now();
+    for (long i = sent; i < MESSAGES; ++i) {
+        lateness.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - (start + i * INTERVAL)).count());
+    }
+    long dropped = 0;
+    for (const Subscriber & sub : subs) {
+        dropped += sub.dropped;
+    }
+    // Who is stuck writing where at the cut-off, before the cancellations below unblock them.
+    const TaskCounts counts = s.task_table().counts();
+    std::vector<TaskSample> parked(TASK_SLOTS);
+    parked.resize(s.task_table().snapshot(parked));
+    std::erase_if(parked, [](const TaskSample & task) { return task.reason != WaitReason::WRITE; });
+    const size_t top = std::min<size_t>(parked.size(), 3);
+    std::ranges::partial_sort(parked, parked.begin() + top, std::ranges::greater{}, &TaskSample::parked_ns);
+
+    stop = true;
+    for (Subscriber & sub : subs) {
+        sub.cancel.cancel();
+    }
+    while (!done) {
+        if (int err = s.pump_events()) {
+            return err;
+        }
+    }
+    for (Subscriber & sub : subs) {
+        s.forget_fd(sub.write_fd);
+        close(sub.write_fd);
+    }
+    while (live > 0) {
+        if (int err = s.pump_events()) {
+            return err;
+        }
+    }
+    for (Subscriber & sub : subs) {
+        s.forget_fd(sub.read_fd);
+        close(sub.read_fd);
+    }
+    std::cout << (shed ? "shed   " : "noshed ") << num_healthy << " healthy " << num_stuck << " stuck: unsent at cut-off "
+              << unsent << ", dropped " << dropped << ", lateness " << lateness << "\n";
+    if constexpr (TASK_STATS_ENABLED) {
+        std::cout << "  tasks at cut-off: " << counts.runnable << " runnable, " << counts.blocked << " blocked, longest parked writes:";
+        for (size_t i = 0; i < top; ++i) {
+            std::cout << " task " << parked[i].id << " fd " << parked[i].fd << " for " << parked[i].parked_ns / 1000 << " us";
+        }
+        if (top == 0) {
+            std::cout << " none";
+        }
+        std::cout << "\n";
+    }
+    return 0;
+}
+
+Coro duplex_reader(Scheduler * scheduler, int *live, const char * name, const int fd, int count) {
+    char buf[64];
+    ++*live;
+    while (count--) {
+        AsyncIOResult result = co_await scheduler->async_read(fd, buf, sizeof(buf));
+        if (result.first == 0) {
+            break;
+        }
+        std::cout << name << " read " << std::string_view(buf, result.first) << "\n";
+    }
+    --*live;
+}
+
+Coro duplex_writer(Scheduler * scheduler, int *live, const int fd, std::string_view msg, int count) {
+    ++*live;
+    while (count--) {
+        co_await scheduler->async_write(fd, msg.data(), msg.size());
+    }
+    --*live;
+}
 
-    assert(buzz_pipe_fds[0] < MAX_EXCLUSIVE_FD);
-    assert(buzz_pipe_fds[1] < MAX_EXCLUSIVE_FD);
+// Nothing is ever written to fd, the read gives up after timeout.
+Coro deadline_reader(Scheduler * scheduler, int *live, const int fd, std::chrono::milliseconds timeout) {
+    char buf[64];
+    ++*live;
+    AsyncIOResult result = co_await with_deadline(scheduler->async_read(fd, buf, sizeof(buf)), timeout);
+    std::cout << "deadline reader " << ((result.second == ETIMEDOUT) ? "timed out" : "read") << " after " << timeout.count() << "ms\n";
+    --*live;
+}
 
-    int timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
-    if (timerfd < 0) {
-        std::cerr<< "timerfd_create call failed.\n";
+// Two readers and a writer share one end of a socketpair while the other end echoes traffic back.
+int duplex() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds) < 0) {
+        std::cerr<< "socketpair call failed\n";
         return errno;
     }
-    assert(timerfd < MAX_EXCLUSIVE_FD);
 
-    itimerspec t;
-    t.it_value.tv_sec =0;
-    t.it_value.tv_nsec = 100000000;
-    t.it_interval.tv_sec = 0;
-    t.it_interval.tv_nsec= 100000000;
-    if(timerfd_settime(timerfd, 0, &t, nullptr) < 0) {
-        std::cerr<<"timerfd_settime call failed.\n";
+    int idle_fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, idle_fds) < 0) {
+        std::cerr<< "socketpair call failed\n";
         return errno;
     }
 
     Scheduler s;
+    int live = 0;
+    deadline_reader(&s, &live, idle_fds[0], std::chrono::milliseconds(50));
+    duplex_reader(&s, &live, "reader1", fds[0], 2);
+    duplex_reader(&s, &live, "reader2", fds[0], 2);
+    duplex_reader(&s, &live, "peer", fds[1], 4);
+    duplex_writer(&s, &live, fds[0], "ping", 4);
+    duplex_writer(&s, &live, fds[1], "pong", 4);
+    while (live > 0) {
+        if (int err = s.pump_events()) {
+            return err;
+        }
+    }
+    if constexpr (STATS) {
+        std::cout << s.snapshot();
+    }
+    close(fds[0]);
+    close(fds[1]);
+    close(idle_fds[0]);
+    close(idle_fds[1]);
+    return 0;
+}
+
+Coro bench_sleeper(Scheduler * scheduler, int *live, double *late_ms, std::chrono::milliseconds timeout) {
+    ++*live;
+    auto start = std::chrono::steady_clock::now();
+    co_await scheduler->sleep_for(timeout);
+    *late_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start - timeout).count();
+    --*live;
+}
+
+// Wheel operations on num_timers timers spread over 10 minutes, then num_sleepers
+// coroutines sleeping up to 100ms on one Scheduler driven only by the wheel.
+int bench_timers(int num_timers, int num_sleepers) {
+    std::mt19937 rng{42};
+    std::uniform_int_distribution<uint64_t> delay{1, 600000};
+    std::vector<Timer> timers(num_timers);
+    TimerWheel wheel;
+    auto ns_per = [](auto start, long n) {
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / n;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (Timer & timer : timers) {
+        wheel.add_at(&timer, delay(rng));
+    }
+    double add_ns = ns_per(start, num_timers);
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < num_timers; i += 2) {
+        wheel.cancel(&timers[i]);
+    }
+    double cancel_ns = ns_per(start, num_timers / 2);
+
+    long fired = 0;
+    start = std::chrono::steady_clock::now();
+    wheel.advance(600000, [&](Timer *) { ++fired; });
+    double advance_ns = ns_per(start, fired);
+
+    std::cout << "timers " << num_timers << ", add " << add_ns << " ns, cancel " << cancel_ns
+              << " ns, fire " << advance_ns << " ns/timer (" << fired << " fired over 600000 ticks)\n";
+
+    Scheduler s;
+    int live = 0;
+    double late_ms = 0;
+    std::uniform_int_distribution<int> sleep{1, 100};
+    for (int i = 0; i < num_sleepers; ++i) {
+        bench_sleeper(&s, &live, &late_ms, std::chrono::milliseconds(sleep(rng)));
+    }
+    long pumps = 0;
+    while (live > 0) {
+        if (int err = s.pump_events()) {
+            return err;
+        }
+        ++pumps;
+    }
+    std::cout << "sleepers " << num_sleepers << ", pumps " << pumps << ", mean lateness " << late_ms / num_sleepers << " ms\n";
+    return 0;
+}
+
+Coro pingpong(Scheduler * scheduler, bool *done, const int in, const int out, long rounds, bool initiator) {
+    char c = 'x';
+    while (rounds--) {
+        if (initiator) {
+            co_await scheduler->async_write(out, &c, 1);
+        }
+        co_await scheduler->async_read(in, &c, 1);
+        if (!initiator) {
+            co_await scheduler->async_write(out, &c, 1);
+        }
+    }
+    *done = true;
+}
+
+// Round trip of one byte over a pipe pair between two coroutines on one Scheduler.
+int pingpong_rounds(Backend backend, long rounds) {
+    int ping[2];
+    int pong[2];
+    if (pipe2(ping, O_NONBLOCK) < 0 || pipe2(pong, O_NONBLOCK) < 0) {
+        std::cerr<< "pipe2 call failed\n";
+        return errno;
+    }
+    {
+        Scheduler s{backend};
+        bool initiator_done = false;
+        bool peer_done = false;
+        pingpong(&s, &peer_done, ping[0], pong[1], rounds, false);
+        pingpong(&s, &initiator_done, pong[0], ping[1], rounds, true);
+        while (!initiator_done || !peer_done) {
+            if (int err = s.pump_events()) {
+                return err;
+            }
+        }
+    }
+    for (int fd : {ping[0], ping[1], pong[0], pong[1]}) {
+        close(fd);
+    }
+    return 0;
+}
+
+void suite() {
+    static constexpr long ROUNDS = 100000;
+    static constexpr long MESSAGES = 1000000;
+    BenchSuite bench{"pipes"};
+    bench.run("pingpong_epoll", ROUNDS, [] { pingpong_rounds(Backend::EPOLL, ROUNDS); });
+    bench.run("pingpong_io_uring", ROUNDS, [] { pingpong_rounds(Backend::IO_URING, ROUNDS); });
+    bench.run("async_write_read_5b", MESSAGES / 10, [] {
+        int fds[2];
+        if (pipe2(fds, O_NONBLOCK) < 0) {
+            return;
+        }
+        Scheduler s;
+        bool done = false;
+        stream_consumer(&s, &done, false, fds[0], MESSAGES / 10 * 5);
+        stream_producer(&s, false, fds[1], MESSAGES / 10);
+        while (!done && s.pump_events() == 0);
+        close(fds[0]);
+        close(fds[1]);
+    });
+    bench.run("stream_write_read_5b", MESSAGES, [] {
+        int fds[2];
+        if (pipe2(fds, O_NONBLOCK) < 0) {
+            return;
+        }
+        Scheduler s;
+        bool done = false;
+        stream_consumer(&s, &done, true, fds[0], MESSAGES * 5);
+        stream_producer(&s, true, fds[1], MESSAGES);
+        while (!done && s.pump_events() == 0);
+        close(fds[0]);
+        close(fds[1]);
+    });
+
+    // Two coroutine switches per line and one read per 64 KiB, bytes_per_op is the mean line length.
+    const std::string block = sample_block();
+    const long repeats = MESSAGES / 1024;
+    const double line_bytes = static_cast<double>(block.size()) / 1024;
+    for (Backend backend : {Backend::EPOLL, Backend::IO_URING}) {
+        const std::string suffix = (backend == Backend::EPOLL) ? "_epoll" : "_io_uring";
+        bench.run("read_lines" + suffix, repeats * 1024, [&] { lines_pipeline(backend, block, repeats, false); }, line_bytes);
+        bench.run("parse_samples" + suffix, repeats * 1024, [&] { lines_pipeline(backend, block, repeats, true); }, line_bytes);
+    }
+
+    // ns per await level, the deepest chain shows the stack does not grow with it.
+    for (long depth : {10L, 1000L, 1000000L}) {
+        bench.run("task_chain_depth_" + std::to_string(depth), depth * (1000000 / depth), [=] {
+            for (long i = 0; i < 1000000 / depth; ++i) {
+                chain_depth(depth);
+            }
+        });
+    }
+    // ns per request round trip, a pipe write to a peer that answers on every fanout pipe.
+    for (long fanout : {1L, 8L, 64L}) {
+        bench.run("when_all_fanout_" + std::to_string(fanout), ROUNDS / fanout, [=] { fanout_rounds(fanout, ROUNDS / fanout, false); });
+        bench.run("when_any_fanout_" + std::to_string(fanout), ROUNDS / fanout, [=] { fanout_rounds(fanout, ROUNDS / fanout, true); });
+    }
+}
+
+int main(int argc, char ** argv) {
+    std::string_view mode = (argc > 1) ? argv[1] : "";
+    if (mode == "suite") {
+        suite();
+        return 0;
+    }
+    if (mode == "bench") {
+        if (int err = bench_pump(10000, 2000)) {
+            return err;
+        }
+        if (int err = bench_backend(Backend::EPOLL, 1000000)) {
+            return err;
+        }
+        if (int err = bench_timers(1000000, 100000)) {
+            return err;
+        }
+        if (int err = bench_stream(1000000)) {
+            return err;
+        }
+        if (int err = bench_lines(1000)) {
+            return err;
+        }
+        for (bool shed : {false, true}) {
+            if (int err = bench_stuck_peers(16, 1, shed)) {
+                return err;
+            }
+        }
+        return bench_backend(Backend::IO_URING, 1000000);
+    }
+    if (mode == "duplex") {
+        return duplex();
+    }
+    if (mode == "stuck") {
+        for (bool shed : {false, true}) {
+            if (int err = bench_stuck_peers(16, 1, shed)) {
+                return err;
+            }
+        }
+        return 0;
+    }
+
+    int fizz_pipe_fds[2];
+    if (pipe2(fizz_pipe_fds, O_DIRECT | O_NONBLOCK) < 0) {
+        std::cerr<< "fizz pipe2 call failed\n";
+        return errno;
+    }
+
+    int buzz_pipe_fds[2];
+    if (pipe2(buzz_pipe_fds, O_DIRECT | O_NONBLOCK) < 0) {
+        std::cerr<< "buzz pipe2 call failed\n";
+        return errno;
+    }
+
+    Scheduler s{(mode == "uring") ? Backend::IO_URING : Backend::EPOLL};
     bool done = false;
     fizz(&s, fizz_pipe_fds[1]);
     buzz(&s, buzz_pipe_fds[1]);
-    consume(&s, &done, fizz_pipe_fds[0], buzz_pipe_fds[0], timerfd);
+    consume(&s, &done, fizz_pipe_fds[0], buzz_pipe_fds[0]);
 
     while(!done) {
         if (int err = s.pump_events()) {
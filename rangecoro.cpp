@@ -1,25 +1,46 @@
 #include <coroutine>
 #include <iostream>
+#include <iterator>
+#include <ranges>
 #include <string>
 #include <print>
+#include <string_view>
+#include <type_traits>
 #include <utility>
 #include <vector>
 #include <algorithm>
+#include <concepts>
+
+#include "bench.h"
+#include "framepool.h"
 
 using namespace std::string_literals;
 
+// Generator<T, Ref> models std::ranges::input_range. Ref is what operator*
+// returns, by default a const reference into the coroutine frame, so large
+// elements are never copied on their way to the consumer. The same
+// `yielded` rule as std::generator applies: a reference Ref is yielded as
+// is, a value Ref as const Ref&. Either way the promise only keeps the
+// address, which stays valid while the coroutine is suspended in co_yield,
+// temporaries included. The coroutine starts eagerly, so value() is
+// available right after creation.
+template <typename T, typename Ref = const T&>
 struct Generator {
+    using value_type = std::remove_cvref_t<T>;
+    using reference = Ref;
+    using yielded = std::conditional_t<std::is_reference_v<Ref>, Ref, const Ref&>;
 
-    struct promise_type {
-        int value{};
+    struct promise_type : PooledPromise {
+        std::add_pointer_t<yielded> current{};
 
         void unhandled_exception() noexcept {}
         Generator get_return_object() { return Generator{this}; }
         std::suspend_never initial_suspend() noexcept { return {}; }
-        std::suspend_always yield_value(int msg) noexcept {
-            value = std::move(msg);
+        std::suspend_always yield_value(yielded v) noexcept {
+            current = std::addressof(v);
             return {};
         }
+        void return_void() noexcept {}
         std::suspend_always final_suspend() noexcept { return {}; }
     };
 
@@ -27,49 +48,241 @@ struct Generator {
     handle corohdl{};
     explicit Generator(promise_type* p ) : corohdl{handle::from_promise(*p)} {}
     Generator(Generator && rhs) : corohdl{std::exchange(rhs.corohdl, nullptr)} {}
+    Generator & operator=(Generator && rhs) {
+        if (this != &rhs) {
+            if (corohdl) corohdl.destroy();
+            corohdl = std::exchange(rhs.corohdl, nullptr);
+        }
+        return *this;
+    }
     ~Generator() { if (corohdl) corohdl.destroy(); }
     bool is_done() const { return corohdl.done(); }
-    auto value() const { return std::move(corohdl.promise().value); }
+    reference value() const { return static_cast<reference>(*corohdl.promise().current); }
     void resume() { if(!corohdl.done()) corohdl.resume(); }
     
-    struct sentinel{};
     struct iterator {
+        using iterator_concept = std::input_iterator_tag;
+        using value_type = Generator::value_type;
+        using difference_type = std::ptrdiff_t;
+
         handle corohdl{};
-        bool operator == (sentinel) const { return corohdl.done(); }
+        friend bool operator == (const iterator & it, std::default_sentinel_t) { return it.corohdl.done(); }
         iterator &  operator ++() { corohdl.resume(); return *this; }
-        int operator*() const { return corohdl.promise().value; }
+        void operator ++(int) { ++*this; }
+        reference operator*() const { return static_cast<reference>(*corohdl.promise().current); }
     };
 
     iterator begin() { return {corohdl}; }
-    sentinel end() { return {}; }
+    std::default_sentinel_t end() { return {}; }
 };
 
+static_assert(std::ranges::input_range<Generator<int>>);
+static_assert(std::ranges::input_range<Generator<std::string, std::string>>);
 
-template<typename T>
-Generator interleave(T a, T b) {
-    auto l = [](T & v) -> Generator {
-        for (const auto & x : v) co_yield x;
-    };
+template <typename G>
+concept generator_type = requires { typename G::promise_type; } && std::ranges::input_range<G>;
 
-    auto agen = l(a);
-    auto bgen = l(b);
+// Yields references to the elements of c, which has to outlive the generator.
+template <std::ranges::input_range C>
+Generator<std::ranges::range_value_t<C>> elements(const C & c) {
+    for (const auto & x : c) co_yield x;
+}
 
-    while (!agen.is_done() || !bgen.is_done()) {
-        
-        if (!agen.is_done()) {
-            co_yield agen.value();
-            agen.resume();
+// Round-robin over any number of generators, exhausted ones drop out and the
+// rest keep their order. Elements are passed through by reference.
+template <typename T, typename Ref>
+Generator<T, Ref> interleave(std::vector<Generator<T, Ref>> gens) {
+    while (!gens.empty()) {
+        for (auto & g : gens) {
+            if (g.is_done()) continue;
+            co_yield g.value();
+            g.resume();
         }
+        std::erase_if(gens, [](const auto & g) { return g.is_done(); });
+    }
+}
+
+template <generator_type G, generator_type... Gs>
+    requires (std::same_as<G, Gs> && ...)
+G interleave(G first, Gs... rest) {
+    std::vector<G> gens;
+    gens.reserve(1 + sizeof...(rest));
+    gens.push_back(std::move(first));
+    (gens.push_back(std::move(rest)), ...);
+    return interleave(std::move(gens));
+}
+
+// K-way merge of generators that are each sorted by cmp, O(log K) per element.
+// A binary min-heap holds the indices of the live generators keyed by their
+// current element. After the top is yielded it is advanced in place and
+// sifted down, or replaced by the last leaf once it is exhausted.
+template <typename T, typename Ref, typename Cmp = std::ranges::less>
+Generator<T, Ref> merge(std::vector<Generator<T, Ref>> gens, Cmp cmp = {}) {
+    std::vector<size_t> heap;
+    heap.reserve(gens.size());
+    for (size_t i = 0; i < gens.size(); ++i) {
+        if (!gens[i].is_done()) heap.push_back(i);
+    }
+    auto after = [&](size_t a, size_t b) { return cmp(gens[b].value(), gens[a].value()); };
+    std::ranges::make_heap(heap, after);
 
-        if (!bgen.is_done()) {
-            co_yield bgen.value();
-            bgen.resume();
+    while (!heap.empty()) {
+        Generator<T, Ref> & top = gens[heap.front()];
+        co_yield top.value();
+        top.resume();
+        if (top.is_done()) {
+            heap.front() = heap.back();
+            heap.pop_back();
+        }
+        const size_t n = heap.size();
+        for (size_t i = 0;;) {
+            size_t child = 2 * i + 1;
+            if (child >= n) break;
+            if (child + 1 < n && after(heap[child], heap[child + 1])) ++child;
+            if (!after(heap[i], heap[child])) break;
+            std::swap(heap[i], heap[child]);
+            i = child;
         }
     }
 }
 
-int main()
+template <generator_type G, generator_type... Gs>
+    requires (std::same_as<G, Gs> && ...)
+G merge(G first, Gs... rest) {
+    std::vector<G> gens;
+    gens.reserve(1 + sizeof...(rest));
+    gens.push_back(std::move(first));
+    (gens.push_back(std::move(rest)), ...);
+    return merge(std::move(gens));
+}
+
+// The comparator goes first, a pack can only be deduced at the end.
+template <typename Cmp, generator_type G, generator_type... Gs>
+    requires (!generator_type<Cmp> && (std::same_as<G, Gs> && ...))
+G merge(Cmp cmp, G first, Gs... rest) {
+    std::vector<G> gens;
+    gens.reserve(1 + sizeof...(rest));
+    gens.push_back(std::move(first));
+    (gens.push_back(std::move(rest)), ...);
+    return merge(std::move(gens), std::move(cmp));
+}
+
+struct Record {
+    long id;
+    char payload[248];
+};
+
+template <typename Ref>
+Generator<std::string, Ref> strings(const std::vector<std::string> & v) {
+    for (const auto & s : v) co_yield s;
+}
+
+template <typename Ref>
+Generator<Record, Ref> records(const std::vector<Record> & v) {
+    for (const auto & r : v) co_yield r;
+}
+
+// Stream i of k yields i, i + k, i + 2k, ... so merging all of them gives 0 .. total - 1.
+Generator<long> stride(long first, long step, long end) {
+    for (long v = first; v < end; v += step) co_yield v;
+}
+
+std::vector<Generator<long>> strided_streams(long k, long total) {
+    std::vector<Generator<long>> gens;
+    for (long i = 0; i < k; ++i) gens.push_back(stride(i, k, total));
+    return gens;
+}
+
+// Element throughput of interleave() consumed through the range interface,
+// merge() against interleave() as K grows, then by-reference against by-value yield for 64 byte strings and 256 byte
+// structs, and a filter/transform/take pipeline composed over a generator.
+void suite()
+{
+    static constexpr long ELEMENTS = 1000000;
+    BenchSuite bench{"rangecoro"};
+    std::vector<int> left(ELEMENTS / 2, 1);
+    std::vector<int> right(ELEMENTS / 2, 2);
+    bench.run("range_for_element", ELEMENTS, [&] {
+        Generator g{interleave(elements(left), elements(right))};
+        long sum = 0;
+        for (int v : g) {
+            sum += v;
+        }
+        bench_keep(sum);
+    });
+
+    for (long k : {2L, 8L, 64L, 512L, 4096L}) {
+        bench.run("merge_k" + std::to_string(k), ELEMENTS, [=] {
+            long sum = 0;
+            for (long v : merge(strided_streams(k, ELEMENTS))) {
+                sum += v;
+            }
+            bench_keep(sum);
+        });
+        bench.run("interleave_k" + std::to_string(k), ELEMENTS, [=] {
+            long sum = 0;
+            for (long v : interleave(strided_streams(k, ELEMENTS))) {
+                sum += v;
+            }
+            bench_keep(sum);
+        });
+    }
+
+    std::vector<std::string> texts(ELEMENTS, std::string(64, 'x'));
+    bench.run("string_by_reference", ELEMENTS, [&] {
+        size_t total = 0;
+        for (const std::string & s : strings<const std::string &>(texts)) {
+            total += s.size();
+        }
+        bench_keep(total);
+    });
+    bench.run("string_by_value", ELEMENTS, [&] {
+        size_t total = 0;
+        for (std::string s : strings<std::string>(texts)) {
+            total += s.size();
+        }
+        bench_keep(total);
+    });
+
+    std::vector<Record> rows(ELEMENTS);
+    for (long i = 0; i < ELEMENTS; ++i) {
+        rows[i].id = i;
+    }
+    bench.run("record_by_reference", ELEMENTS, [&] {
+        long sum = 0;
+        for (const Record & r : records<const Record &>(rows)) {
+            sum += r.id;
+        }
+        bench_keep(sum);
+    });
+    bench.run("record_by_value", ELEMENTS, [&] {
+        long sum = 0;
+        for (Record r : records<Record>(rows)) {
+            bench_keep(r);
+            sum += r.id;
+        }
+        bench_keep(sum);
+    });
+    bench.run("record_views_pipeline", ELEMENTS, [&] {
+        long sum = 0;
+        auto ids = records<const Record &>(rows)
+            | std::views::filter([](const Record & r) { return r.id % 3 == 0; })
+            | std::views::transform([](const Record & r) { return r.id * 2; })
+            | std::views::take(ELEMENTS / 4);
+        for (long id : ids) {
+            sum += id;
+        }
+        bench_keep(sum);
+    });
+}
+
+int main(int argc, char ** argv)
 {
+    if (argc > 1 && std::string_view{argv[1]} == "suite") {
+        suite();
+        return 0;
+    }
+
     using IntVector = std::vector<int>;
     IntVector mainv{1,2,3,4,5,6,7,8};
     auto middle_iter{mainv.begin()};
@@ -77,7 +290,23 @@ int main()
     IntVector left_half(mainv.begin(), middle_iter);
     IntVector right_half(middle_iter, mainv.end());
 
-    Generator g{interleave(left_half, right_half)};
+    Generator g{interleave(elements(left_half), elements(right_half))};
     for(const auto & v : g) { std::cout<< v << '\n'; } ;
+
+    auto odd_squares = interleave(elements(left_half), elements(right_half))
+        | std::views::filter([](int v) { return v % 2; })
+        | std::views::transform([](int v) { return v * v; })
+        | std::views::take(3);
+    for (int v : odd_squares) { std::cout << "odd square " << v << '\n'; }
+
+    IntVector primes{2, 3, 5, 7, 11};
+    IntVector squares{1, 4, 9};
+    IntVector evens{0, 2, 4, 6};
+    for (int v : merge(elements(primes), elements(squares), elements(evens))) { std::cout << v << ' '; }
+    std::cout << '\n';
+    IntVector countdown{10, 8, 6};
+    IntVector odd_countdown{9, 7, 5};
+    for (int v : merge(std::ranges::greater{}, elements(countdown), elements(odd_countdown))) { std::cout << v << ' '; }
+    std::cout << '\n';
     return 0;
 }
@@ -0,0 +1,437 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+// Runtime introspection for the single-threaded schedulers. A coroutine whose
+// promise derives from TracedPromise gets a slot in the TaskTable of the
+// scheduler it first parks on and keeps it until it finishes, a coroutine
+// resumed inline by its awaiter runs on the awaiter's slot. Awaiters report
+// parks through task_park() and resumes through task_resume(). Run time is
+// measured on one in TASK_SAMPLE_PERIOD resumes and extrapolated.
+//
+// snapshot(), counts() and slowest() read the slots through per-slot sequence
+// locks and neither allocate nor block, so a side thread or a signal handler
+// may call them while the scheduler runs. Tasks must not outlive the
+// scheduler they ran on.
+//
+// Build with -DTASK_STATS to compile the hooks in, otherwise they compile to
+// nothing and the tables stay empty.
+#ifdef TASK_STATS
+static constexpr bool TASK_STATS_ENABLED = true;
+#else
+static constexpr bool TASK_STATS_ENABLED = false;
+#endif
+
+static constexpr size_t TASK_SLOTS = 4096;
+static constexpr uint64_t TASK_SAMPLE_PERIOD = 256;
+static constexpr int TASK_READ_ATTEMPTS = 64;
+
+enum class WaitReason : uint8_t {
+    RUNNING,
+    // In a ready queue.
+    RUNNABLE,
+    // In the earliest-deadline-first queue.
+    DEADLINE,
+    SEND,
+    RECV,
+    // On TaskSample::fd.
+    READ,
+    WRITE,
+    SLEEP,
+    // On other coroutines, the children of a task group.
+    AWAIT,
+};
+
+inline const char * wait_reason_name(WaitReason reason) {
+    static constexpr const char * names[] = {"running", "runnable", "deadline", "send", "recv", "read", "write", "sleep", "await"};
+    return names[static_cast<size_t>(reason)];
+}
+
+struct TaskSample {
+    // Per table, in the order the tasks first parked.
+    uint64_t id;
+    // Finished runs, from the start or a resume up to the next park.
+    uint64_t runs;
+    // Estimated CPU time of all runs, 0 until one was sampled.
+    uint64_t run_ns;
+    // Mean CPU time of the sampled runs.
+    uint64_t mean_run_ns;
+    // Since the task parked, 0 while it runs.
+    uint64_t parked_ns;
+    WaitReason reason;
+    // READ and WRITE only, -1 otherwise.
+    int fd;
+};
+
+struct TaskCounts {
+    size_t running;
+    // RUNNABLE and DEADLINE.
+    size_t runnable;
+    size_t blocked;
+    // Tasks that found the table full, they are not reported.
+    uint64_t untracked;
+};
+
+class TaskTable;
+
+// One task's record, written by the scheduler thread under a sequence lock.
+struct alignas(64) TaskSlot {
+    // Returns what to pass to end_write(), one load of m_seq per update.
+    [[gnu::always_inline]] uint32_t begin_write() {
+        const uint32_t seq = m_seq.load(std::memory_order_relaxed) + 1;
+        m_seq.store(seq, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return seq + 1;
+    }
+    [[gnu::always_inline]] void end_write(uint32_t seq) { m_seq.store(seq, std::memory_order_release); }
+
+    template <typename T>
+    [[gnu::always_inline]] static void add(std::atomic<T> & field, T delta) {
+        field.store(field.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    // Odd while the scheduler thread updates the fields below it.
+    std::atomic<uint32_t> m_seq{0};
+    std::atomic<WaitReason> m_reason{WaitReason::RUNNING};
+    std::atomic<int> m_fd{-1};
+    std::atomic<uint32_t> m_sampled{0};
+    // 0 while the slot is free.
+    std::atomic<uint64_t> m_id{0};
+    std::atomic<uint64_t> m_runs{0};
+    std::atomic<uint64_t> m_sampled_ns{0};
+    std::atomic<int64_t> m_parked_at{0};
+
+    // Scheduler thread only.
+    TaskTable * m_table = nullptr;
+    // Clock at the start of the running resume if it is sampled, 0 otherwise.
+    int64_t m_run_start = 0;
+};
+
+// A park touches one cache line besides the frame.
+static_assert(sizeof(TaskSlot) == 64);
+
+// Promise base of coroutines that report to a TaskTable.
+class TracedPromise {
+public:
+    TracedPromise() = default;
+    TracedPromise(const TracedPromise &) = delete;
+    TracedPromise& operator=(const TracedPromise &) = delete;
+    ~TracedPromise() { task_finished(); }
+
+    TaskSlot * task_slot() const { return reinterpret_cast<TaskSlot*>(m_task_slot & ~BORROWED); }
+    // Gives the slot back, for final_suspend() of coroutines whose frame lives on.
+    [[gnu::always_inline]] void task_finished() {
+        if constexpr (TASK_STATS_ENABLED) {
+            if (m_task_slot) {
+                task_release();
+            }
+        }
+    }
+    // Runs on the slot of caller, which resumes this coroutine inline, if it has one.
+    void task_borrow(const TracedPromise & caller);
+
+    // The slot address, with BORROWED set when it belongs to an awaiting coroutine.
+    static constexpr uintptr_t BORROWED = 1;
+    uintptr_t m_task_slot = 0;
+
+private:
+    void task_release();
+};
+
+class TaskTable {
+public:
+    explicit TaskTable(size_t capacity = TASK_SLOTS) : m_capacity{capacity}, m_now{clock_ns()} {
+        m_overflow.m_table = this;
+    }
+    TaskTable(const TaskTable &) = delete;
+    TaskTable& operator=(const TaskTable &) = delete;
+
+    // Scheduler thread only, through task_park() and the other hooks below.
+    TaskSlot & attach(TracedPromise & promise) {
+        TaskSlot * slot;
+        if (!m_free.empty()) {
+            slot = m_free.back();
+            m_free.pop_back();
+        } else if (const size_t used = m_used.load(std::memory_order_relaxed); used < m_capacity) {
+            if (!m_slots) {
+                m_slots = std::make_unique<TaskSlot[]>(m_capacity);
+                m_free.reserve(m_capacity);
+            }
+            slot = &m_slots[used];
+            slot->m_table = this;
+            m_used.store(used + 1, std::memory_order_release);
+        } else {
+            // Full: the task writes to a slot nobody reads.
+            m_untracked.store(m_untracked.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            slot = &m_overflow;
+        }
+        const uint32_t seq = slot->begin_write();
+        slot->m_reason.store(WaitReason::RUNNING, std::memory_order_relaxed);
+        slot->m_fd.store(-1, std::memory_order_relaxed);
+        slot->m_id.store(m_next_id++, std::memory_order_relaxed);
+        slot->m_runs.store(0, std::memory_order_relaxed);
+        slot->m_sampled.store(0, std::memory_order_relaxed);
+        slot->m_sampled_ns.store(0, std::memory_order_relaxed);
+        slot->end_write(seq);
+        slot->m_run_start = 0;
+        promise.m_task_slot = reinterpret_cast<uintptr_t>(slot);
+        return *slot;
+    }
+
+    void detach(TaskSlot & slot) {
+        if (m_running.load(std::memory_order_relaxed) == &slot) {
+            m_running.store(nullptr, std::memory_order_relaxed);
+        }
+        if (&slot == &m_overflow) {
+            return;
+        }
+        const uint32_t seq = slot.begin_write();
+        slot.m_id.store(0, std::memory_order_relaxed);
+        slot.end_write(seq);
+        m_free.push_back(&slot);
+    }
+
+    // Inlined into every await_suspend() and await_resume(), the sampled
+    // paths are kept out of line so they do not cost registers there.
+    [[gnu::always_inline]] void park(TaskSlot & slot, WaitReason reason, int fd) {
+        m_running.store(nullptr, std::memory_order_relaxed);
+        const uint32_t seq = slot.begin_write();
+        if (slot.m_run_start) [[unlikely]] {
+            end_sample(slot);
+        }
+        TaskSlot::add<uint64_t>(slot.m_runs, 1);
+        slot.m_reason.store(reason, std::memory_order_relaxed);
+        slot.m_fd.store(fd, std::memory_order_relaxed);
+        slot.m_parked_at.store(m_now, std::memory_order_relaxed);
+        slot.end_write(seq);
+    }
+
+    // The task is runnable again but has not been resumed yet.
+    void wake(TaskSlot & slot) {
+        const uint32_t seq = slot.begin_write();
+        slot.m_reason.store(WaitReason::RUNNABLE, std::memory_order_relaxed);
+        slot.m_fd.store(-1, std::memory_order_relaxed);
+        slot.end_write(seq);
+    }
+
+    // Leaves the slot alone, only the next park writes to it again.
+    [[gnu::always_inline]] void resume(TaskSlot & slot) {
+        m_running.store(&slot, std::memory_order_relaxed);
+        // Golden ratio hashing of the resume count, unlike a plain modulo it
+        // does not keep sampling the same tasks of a fixed round-robin cycle.
+        if ((++m_resumes * 0x9e3779b97f4a7c15) >> (64 - std::countr_zero(TASK_SAMPLE_PERIOD)) == 0) [[unlikely]] {
+            start_sample(slot);
+        }
+    }
+
+    // For the scheduler to call after it has blocked, see the clock above.
+    void tick() { m_now = clock_ns(); }
+
+    // Any thread or signal handler. Fills out with up to out.size() live tasks, returns how many.
+    size_t snapshot(std::span<TaskSample> out) const {
+        const int64_t now = clock_ns();
+        size_t n = 0;
+        const size_t used = m_used.load(std::memory_order_acquire);
+        for (size_t i = 0; i < used && n < out.size(); ++i) {
+            n += read(m_slots[i], now, out[n]);
+        }
+        return n;
+    }
+
+    // The out.size() tasks with the most CPU time per resume, slowest first.
+    size_t slowest(std::span<TaskSample> out) const {
+        if (out.empty()) {
+            return 0;
+        }
+        const int64_t now = clock_ns();
+        // Min-heap on mean_run_ns over the first n entries of out.
+        auto faster = [](const TaskSample & a, const TaskSample & b) { return a.mean_run_ns > b.mean_run_ns; };
+        size_t n = 0;
+        TaskSample sample;
+        const size_t used = m_used.load(std::memory_order_acquire);
+        for (size_t i = 0; i < used; ++i) {
+            if (!read(m_slots[i], now, sample)) {
+                continue;
+            }
+            if (n < out.size()) {
+                out[n++] = sample;
+                std::push_heap(out.begin(), out.begin() + n, faster);
+            } else if (sample.mean_run_ns > out.front().mean_run_ns) {
+                std::pop_heap(out.begin(), out.end(), faster);
+                out.back() = sample;
+                std::push_heap(out.begin(), out.end(), faster);
+            }
+        }
+        std::sort_heap(out.begin(), out.begin() + n, faster);
+        return n;
+    }
+
+    TaskCounts counts() const {
+        const int64_t now = clock_ns();
+        TaskCounts counts{0, 0, 0, m_untracked.load(std::memory_order_relaxed)};
+        TaskSample sample;
+        const size_t used = m_used.load(std::memory_order_acquire);
+        for (size_t i = 0; i < used; ++i) {
+            if (!read(m_slots[i], now, sample)) {
+                continue;
+            }
+            switch (sample.reason) {
+            case WaitReason::RUNNING: ++counts.running; break;
+            case WaitReason::RUNNABLE:
+            case WaitReason::DEADLINE: ++counts.runnable; break;
+            default: ++counts.blocked; break;
+            }
+        }
+        return counts;
+    }
+
+private:
+    [[gnu::noinline]] void start_sample(TaskSlot & slot) { slot.m_run_start = m_now = clock_ns(); }
+
+    // Inside the write section of park().
+    [[gnu::noinline]] void end_sample(TaskSlot & slot) {
+        m_now = clock_ns();
+        TaskSlot::add<uint32_t>(slot.m_sampled, 1);
+        TaskSlot::add<uint64_t>(slot.m_sampled_ns, m_now - slot.m_run_start);
+        slot.m_run_start = 0;
+    }
+
+    // clock_gettime() is async-signal-safe.
+    static int64_t clock_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // False for a free slot and for one that stayed mid-update.
+    bool read(const TaskSlot & slot, int64_t now, TaskSample & sample) const {
+        for (int attempt = 0; attempt < TASK_READ_ATTEMPTS; ++attempt) {
+            const uint32_t seq = slot.m_seq.load(std::memory_order_acquire);
+            if (seq & 1) {
+                continue;
+            }
+            const uint64_t id = slot.m_id.load(std::memory_order_relaxed);
+            const WaitReason reason = slot.m_reason.load(std::memory_order_relaxed);
+            const int fd = slot.m_fd.load(std::memory_order_relaxed);
+            const uint64_t runs = slot.m_runs.load(std::memory_order_relaxed);
+            const uint32_t sampled = slot.m_sampled.load(std::memory_order_relaxed);
+            const uint64_t sampled_ns = slot.m_sampled_ns.load(std::memory_order_relaxed);
+            const int64_t parked_at = slot.m_parked_at.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.m_seq.load(std::memory_order_relaxed) != seq) {
+                continue;
+            }
+            if (!id) {
+                return false;
+            }
+            const uint64_t mean_run_ns = sampled ? sampled_ns / sampled : 0;
+            const bool running = reason == WaitReason::RUNNING || m_running.load(std::memory_order_relaxed) == &slot;
+            if (running) {
+                sample = {id, runs, mean_run_ns * runs, mean_run_ns, 0, WaitReason::RUNNING, -1};
+            } else {
+                sample = {id, runs, mean_run_ns * runs, mean_run_ns, static_cast<uint64_t>(std::max<int64_t>(0, now - parked_at)), reason, fd};
+            }
+            return true;
+        }
+        return false;
+    }
+
+    std::unique_ptr<TaskSlot[]> m_slots;
+    const size_t m_capacity;
+    // Slots below this have been handed out at least once, m_slots is set before it grows.
+    std::atomic<size_t> m_used{0};
+    std::atomic<uint64_t> m_untracked{0};
+    // Reserved up front, a detach never allocates.
+    std::vector<TaskSlot*> m_free;
+    TaskSlot m_overflow;
+    // The task between resume() and its next park, its slot still holds the previous park.
+    std::atomic<const TaskSlot*> m_running{nullptr};
+    uint64_t m_next_id = 1;
+    uint64_t m_resumes = 0;
+    int64_t m_now;
+};
+
+inline void TracedPromise::task_release() {
+    if (!(m_task_slot & BORROWED)) {
+        TaskSlot * slot = task_slot();
+        slot->m_table->detach(*slot);
+    }
+    m_task_slot = 0;
+}
+
+inline void TracedPromise::task_borrow(const TracedPromise & caller) {
+    // A slot of our own is kept while the caller has none, a borrowed one is
+    // dropped as it may belong to an earlier caller of a generator.
+    if (TaskSlot * slot = caller.task_slot()) {
+        if (slot != task_slot()) {
+            task_finished();
+            m_task_slot = reinterpret_cast<uintptr_t>(slot) | BORROWED;
+        }
+    } else if (m_task_slot & BORROWED) {
+        m_task_slot = 0;
+    }
+}
+
+// First park of a traced coroutine, see task_park().
+[[gnu::noinline]] inline void task_attach(TaskSlot *& out, TaskTable & table, TracedPromise & promise, WaitReason reason, int fd) {
+    TaskSlot & slot = table.attach(promise);
+    table.park(slot, reason, fd);
+    out = &slot;
+}
+
+// For await_suspend() of an awaiter, before the coroutine can be resumed and
+// best as its last statement, then the first park is a tail call. A traced
+// coroutine is attached to table on its first park. Awaiters that park on
+// other coroutines pass no table and only report coroutines that already
+// have a slot. Sets out, which starts null, to what the awaiter hands to
+// task_resume().
+template <typename P>
+[[gnu::always_inline]] inline void task_park(TaskSlot *& out, TaskTable * table, std::coroutine_handle<P> h, WaitReason reason, int fd = -1) {
+    if constexpr (TASK_STATS_ENABLED && std::derived_from<P, TracedPromise>) {
+        TracedPromise & promise = h.promise();
+        TaskSlot * slot = promise.task_slot();
+        if (!slot) [[unlikely]] {
+            if (table) {
+                task_attach(out, *table, promise, reason, fd);
+            }
+            return;
+        }
+        slot->m_table->park(*slot, reason, fd);
+        out = slot;
+    }
+}
+
+// For await_suspend() of an awaiter that resumes callee inline on behalf of
+// h, which does not park meanwhile.
+template <typename P>
+inline void task_borrow(TracedPromise & callee, std::coroutine_handle<P> h) {
+    if constexpr (TASK_STATS_ENABLED && std::derived_from<P, TracedPromise>) {
+        callee.task_borrow(h.promise());
+    }
+}
+
+// For await_resume() of the same awaiter.
+[[gnu::always_inline]] inline void task_resume(TaskSlot * slot) {
+    if constexpr (TASK_STATS_ENABLED) {
+        if (slot) {
+            slot->m_table->resume(*slot);
+        }
+    }
+}
+
+// For whoever makes a parked task runnable before the scheduler resumes it.
+inline void task_wake(TaskSlot * slot) {
+    if constexpr (TASK_STATS_ENABLED) {
+        if (slot) {
+            slot->m_table->wake(*slot);
+        }
+    }
+}